@@ -94,11 +94,9 @@ struct Pack<Address>
         packAll(first, last, value.host, value.port);
     }
 
-    static Address unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(Address& value, ConstPackIt first, ConstPackIt last)
     {
-        Address value;
-        unpackAll(first, last, value.host, value.port);
-        return std::move(value);
+        return unpackAll(first, last, value.host, value.port);
     }
 };
 
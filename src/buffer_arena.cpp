@@ -0,0 +1,197 @@
+/* buffer_arena.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 22 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Buffer arena implementation.
+*/
+
+#include "buffer_arena.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* UTILS                                                                      */
+/******************************************************************************/
+
+namespace {
+
+// Sadly there's no portable way to query the default huge page size but this
+// is what x86-64 uses by default.
+enum { HugePageSize = 1 << 21, CacheLine = 64 };
+
+size_t alignUp(size_t value, size_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* BUFFER ARENA                                                               */
+/******************************************************************************/
+
+BufferArena::
+BufferArena(size_t bufferSize, size_t buffers, unsigned flags, Policy policy) :
+    flags(flags), policy(policy),
+    stride(alignUp(bufferSize, CacheLine)), buffers(buffers)
+{
+    assert(bufferSize && buffers);
+
+    stats_.bufferSize = bufferSize;
+    map();
+}
+
+BufferArena::
+~BufferArena()
+{
+    unmap();
+}
+
+BufferArena::
+BufferArena(BufferArena&& other) :
+    flags(other.flags), policy(other.policy),
+    stride(other.stride), buffers(other.buffers),
+    regions(std::move(other.regions)),
+    freeList(std::move(other.freeList)),
+    stats_(other.stats_)
+{
+    other.regions.clear();
+    other.freeList.clear();
+    other.stats_ = Stats();
+}
+
+BufferArena&
+BufferArena::
+operator=(BufferArena&& other)
+{
+    if (this == &other) return *this;
+
+    unmap();
+
+    flags = other.flags;
+    policy = other.policy;
+    stride = other.stride;
+    buffers = other.buffers;
+    regions = std::move(other.regions);
+    freeList = std::move(other.freeList);
+    stats_ = other.stats_;
+
+    other.regions.clear();
+    other.freeList.clear();
+    other.stats_ = Stats();
+
+    return *this;
+}
+
+
+/** MAP_POPULATE is what faults in the pages up front. Huge pages can only be
+    mapped if the pool of reserved huge pages has enough of them left which
+    is rarely the case on a box that wasn't configured for it.
+ */
+void
+BufferArena::
+map()
+{
+    size_t size = alignUp(stride * buffers, sysconf(_SC_PAGESIZE));
+
+    enum { Prot = PROT_READ | PROT_WRITE };
+    enum { Flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE };
+
+    void* ptr = MAP_FAILED;
+    bool huge = false;
+
+    if (flags & HugePages) {
+        size_t hugeSize = alignUp(size, HugePageSize);
+        ptr = mmap(nullptr, hugeSize, Prot, Flags | MAP_HUGETLB, -1, 0);
+
+        if (ptr != MAP_FAILED) {
+            size = hugeSize;
+            huge = true;
+        }
+    }
+
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, size, Prot, Flags, -1, 0);
+        SLICK_CHECK_ERRNO(ptr != MAP_FAILED, "BufferArena.mmap");
+    }
+
+    bool locked = false;
+    if (flags & Lock) {
+        locked = !mlock(ptr, size);
+        SLICK_CHECK_ERRNO(
+                locked || errno == EPERM || errno == ENOMEM || errno == EAGAIN,
+                "BufferArena.mlock");
+    }
+
+    stats_.hugePages = huge && (regions.empty() || stats_.hugePages);
+    stats_.locked = locked && (regions.empty() || stats_.locked);
+
+    uint8_t* start = static_cast<uint8_t*>(ptr);
+    regions.push_back(Region{ start, size });
+
+    size_t count = size / stride;
+    stats_.capacity += count;
+    stats_.regions++;
+
+    // Reserving up front is what keeps free from ever allocating. Buffers are
+    // pushed in reverse so that the lowest addresses are handed out first.
+    freeList.reserve(stats_.capacity);
+    for (size_t i = count; i > 0; --i)
+        freeList.push_back(start + (i - 1) * stride);
+}
+
+void
+BufferArena::
+unmap()
+{
+    assert(!stats_.used);
+
+    for (const auto& region : regions)
+        munmap(region.start, region.size);
+
+    regions.clear();
+    freeList.clear();
+}
+
+
+uint8_t*
+BufferArena::
+alloc()
+{
+    if (freeList.empty()) {
+        stats_.exhausted++;
+        if (policy == Drop || regions.empty()) return nullptr;
+        map();
+    }
+
+    uint8_t* buffer = freeList.back();
+    freeList.pop_back();
+
+    stats_.used++;
+    stats_.peak = std::max(stats_.peak, stats_.used);
+
+    return buffer;
+}
+
+void
+BufferArena::
+free(uint8_t* buffer)
+{
+    assert(stats_.used);
+    assert(std::any_of(regions.begin(), regions.end(), [=] (const Region& r) {
+                return buffer >= r.start && buffer < r.start + r.size;
+            }));
+
+    freeList.push_back(buffer);
+    stats_.used--;
+}
+
+} // slick
@@ -0,0 +1,110 @@
+/* buffer_arena.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 22 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Pre-faulted arena of fixed size I/O buffers.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* BUFFER ARENA                                                               */
+/******************************************************************************/
+
+/** Hands out fixed size buffers carved out of anonymous mappings which are
+    faulted in up front so that handing out a buffer never page faults or
+    calls into the allocator.
+
+    The mappings can optionally be backed by huge pages and locked in memory.
+    Neither is guaranteed: huge pages fall back on regular pages if none are
+    reserved and a failed mlock, usually because of RLIMIT_MEMLOCK, leaves the
+    mapping unlocked. The stats report what we actually got.
+
+    When the arena runs out of buffers it either maps an additional region of
+    the same size (Grow) or refuses to hand out a buffer (Drop).
+
+    Not thread-safe: meant to be owned by a single polling thread.
+ */
+struct BufferArena
+{
+    enum Flags
+    {
+        HugePages = 1 << 0,
+        Lock      = 1 << 1,
+    };
+
+    enum Policy { Grow, Drop };
+
+    struct Stats
+    {
+        Stats() :
+            bufferSize(0), capacity(0), used(0), peak(0), regions(0),
+            exhausted(0), hugePages(false), locked(false)
+        {}
+
+        size_t bufferSize;
+        size_t capacity; // in buffers.
+        size_t used;
+        size_t peak;
+        size_t regions;
+
+        // Number of times the arena ran dry regardless of the policy.
+        size_t exhausted;
+
+        bool hugePages;
+        bool locked;
+    };
+
+    BufferArena() : flags(0), policy(Grow), stride(0), buffers(0) {}
+    BufferArena(
+            size_t bufferSize,
+            size_t buffers,
+            unsigned flags = 0,
+            Policy policy = Grow);
+    ~BufferArena();
+
+    BufferArena(BufferArena&& other);
+    BufferArena& operator=(BufferArena&& other);
+
+    BufferArena(const BufferArena&) = delete;
+    BufferArena& operator=(const BufferArena&) = delete;
+
+    explicit operator bool() const { return !regions.empty(); }
+
+    size_t bufferSize() const { return stats_.bufferSize; }
+    const Stats& stats() const { return stats_; }
+
+    /** Returns nullptr if the arena is exhausted and the policy is Drop. */
+    uint8_t* alloc();
+    void free(uint8_t* buffer);
+
+private:
+
+    void map();
+    void unmap();
+
+    struct Region
+    {
+        uint8_t* start;
+        size_t size;
+    };
+
+    unsigned flags;
+    Policy policy;
+    size_t stride;
+    size_t buffers; // per region.
+
+    std::vector<Region> regions;
+    std::vector<uint8_t*> freeList;
+
+    Stats stats_;
+};
+
+} // slick
@@ -10,8 +10,12 @@
 #include "queue.h"
 #include "notify.h"
 #include "utils.h"
+#include "lockless/ring.h"
+#include "lockless/tls.h"
 
 #include <tuple>
+#include <memory>
+#include <atomic>
 #include <functional>
 
 
@@ -43,8 +47,11 @@ void invoke(const Fn& fn, std::tuple<Args...>& tuple)
 /* DEFER                                                                      */
 /******************************************************************************/
 
-template<size_t QueueSize, typename... Items>
-struct Defer
+/** Producers that find the queue full wait on it according to WaitPolicy (see
+    Backoff in queue.h).
+ */
+template<typename WaitPolicy, size_t QueueSize, typename... Items>
+struct BasicDefer
 {
     typedef std::function<void(Items&&...)> OperationFn;
     OperationFn onOperation;
@@ -70,7 +77,9 @@ struct Defer
     {
         auto op = std::make_tuple(std::forward<Args>(args)...);
 
-        while (!queue.push(std::move(op)));
+        WaitPolicy backoff;
+        while (!queue.push(std::move(op))) backoff();
+
         notify.signal();
     }
 
@@ -88,8 +97,205 @@ struct Defer
 
 private:
 
-    Queue<std::tuple<Items...>, QueueSize> queue;
+    MpscQueue<std::tuple<Items...>, QueueSize> queue;
     Notify notify;
 };
 
+template<size_t QueueSize, typename... Items>
+using Defer = BasicDefer<Backoff, QueueSize, Items...>;
+
+
+/******************************************************************************/
+/* THREAD LOCAL DEFER                                                         */
+/******************************************************************************/
+
+namespace details {
+
+inline size_t nextThreadLocalDeferId()
+{
+    static std::atomic<size_t> id(0);
+    return ++id;
+}
+
+} // namespace details
+
+
+/** Variant of Defer where each producer thread gets its own single-reader
+    single-writer ring which means that producers never contend with each
+    other. The rings are drained in a round-robin fashion by the poll thread.
+
+    Operations are stored by value within the rings and each thread caches the
+    rings it recently used in thread local storage so the producer's fast path
+    neither allocates nor hashes anything.
+
+    Rings are never reclaimed so threads past the first MaxRings to use the
+    object fall back on a shared MpscQueue.
+ */
+template<typename WaitPolicy, size_t QueueSize, typename... Items>
+struct BasicThreadLocalDefer
+{
+    typedef std::function<void(Items&&...)> OperationFn;
+    OperationFn onOperation;
+
+    enum { MaxRings = 1 << 8 };
+
+    BasicThreadLocalDefer() :
+        id(details::nextThreadLocalDeferId()),
+        numRings(0), nextRing(0)
+    {
+        for (auto& ring : rings) ring.store(nullptr);
+    }
+
+    ~BasicThreadLocalDefer()
+    {
+        size_t n = std::min<size_t>(numRings, MaxRings);
+        for (size_t i = 0; i < n; ++i) delete rings[i].load();
+    }
+
+    BasicThreadLocalDefer(const BasicThreadLocalDefer&) = delete;
+    BasicThreadLocalDefer& operator=(const BasicThreadLocalDefer&) = delete;
+
+    int fd() const { return notify.fd(); }
+
+    void poll(size_t cap = 0)
+    {
+        assert(onOperation);
+
+        while (notify.poll());
+
+        size_t n = std::min<size_t>(numRings, MaxRings);
+        size_t ops = 0;
+        bool progress = true;
+
+        while (progress && (!cap || ops < cap)) {
+            progress = false;
+
+            for (size_t i = 0; i < n && (!cap || ops < cap); ++i) {
+                Ring* ring = rings[(nextRing + i) % n].load();
+                if (!ring || ring->queue.empty()) continue;
+
+                auto op = ring->queue.pop();
+                details::invoke(onOperation, op);
+                progress = true;
+                ops++;
+            }
+
+            if (!shared.empty() && (!cap || ops < cap)) {
+                auto op = shared.pop();
+                details::invoke(onOperation, op);
+                progress = true;
+                ops++;
+            }
+        }
+
+        // Avoids always favouring the first ring when we hit the cap.
+        if (n) nextRing = (nextRing + 1) % n;
+
+        if (!empty(n)) notify.signal();
+    }
+
+    template<typename... Args>
+    void defer(Args&&... args)
+    {
+        Op op(std::forward<Args>(args)...);
+        Ring* ring = localRing();
+
+        WaitPolicy backoff;
+        if (!ring) while (!shared.push(std::move(op))) backoff();
+        else while (!ring->queue.push(std::move(op))) backoff();
+
+        notify.signal();
+    }
+
+    template<typename... Args>
+    bool tryDefer(Args&&... args)
+    {
+        Op op(std::forward<Args>(args)...);
+        Ring* ring = localRing();
+
+        bool pushed = ring ?
+            ring->queue.push(std::move(op)) : shared.push(std::move(op));
+        if (!pushed) return false;
+
+        notify.signal();
+        return true;
+    }
+
+private:
+
+    typedef std::tuple<Items...> Op;
+
+    struct Ring
+    {
+        explicit Ring(size_t owner) : owner(owner) {}
+
+        const size_t owner;
+        SpscQueue<Op, QueueSize> queue;
+    };
+
+    bool empty(size_t n) const
+    {
+        for (size_t i = 0; i < n; ++i) {
+            Ring* ring = rings[i].load();
+            if (ring && !ring->queue.empty()) return false;
+        }
+        return shared.empty();
+    }
+
+    /** Returns nullptr if the thread should use the shared queue.
+
+        The cache is keyed on id instead of this so that an object allocated
+        at the address of a dead object doesn't pick up its rings. It's shared
+        by all the objects of the same type so a miss only means that another
+        object evicted the entry and the ring is then looked up again.
+     */
+    Ring* localRing()
+    {
+        enum { CacheSize = 8 };
+        struct CacheEntry { size_t id; Ring* ring; };
+        static locklessTls CacheEntry cache[CacheSize];
+
+        CacheEntry& entry = cache[id % CacheSize];
+        if (entry.id != id) {
+            entry.ring = findRing();
+            entry.id = id;
+        }
+        return entry.ring;
+    }
+
+    /** Rings are only ever created by their owner thread so they can't show
+        up while we're looking for ours.
+     */
+    Ring* findRing()
+    {
+        size_t thread = lockless::threadId();
+
+        size_t n = std::min<size_t>(numRings, MaxRings);
+        for (size_t i = 0; i < n; ++i) {
+            Ring* ring = rings[i].load();
+            if (ring && ring->owner == thread) return ring;
+        }
+
+        size_t index = numRings.fetch_add(1);
+        if (index >= MaxRings) return nullptr;
+
+        Ring* ring = new Ring(thread);
+        rings[index].store(ring);
+        return ring;
+    }
+
+    const size_t id;
+
+    std::atomic<size_t> numRings;
+    std::array<std::atomic<Ring*>, MaxRings> rings;
+    size_t nextRing;
+
+    MpscQueue<Op, QueueSize> shared;
+
+    Notify notify;
+};
+
+template<size_t QueueSize, typename... Items>
+using ThreadLocalDefer = BasicThreadLocalDefer<Backoff, QueueSize, Items...>;
+
 } // slick
@@ -9,44 +9,153 @@
 #include "utils.h"
 #include "lockless/tls.h"
 
+#include <atomic>
 #include <cassert>
+#include <cstring>
+#include <climits>
+#include <chrono>
+#include <type_traits>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/poll.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 
 namespace slick {
 
+namespace {
+
+std::atomic<uint32_t> nextGeneration(0);
+
+
+/******************************************************************************/
+/* DATA                                                                       */
+/******************************************************************************/
+
+// Lets the send path deal with payloads and chains through the same code.
+
+Payload&& toPayload(Payload&& data) { return std::move(data); }
+const Payload& toPayload(const Payload& data) { return data; }
+Payload toPayload(const PayloadChain& chain) { return chain.flatten(); }
+
+void copyPacket(const Payload& data, uint8_t* dest)
+{
+    std::copy(data.packet(), data.packet() + data.packetSize(), dest);
+}
+
+void copyPacket(const PayloadChain& chain, uint8_t* dest)
+{
+    chain.copy(Payload::writeHeader(dest, chain.size()));
+}
+
+ssize_t sendPacket(int fd, const Payload& data, size_t offset, int flags)
+{
+    size_t size = data.packetSize() - offset;
+    return ::send(fd, data.packet() + offset, size, MSG_NOSIGNAL | flags);
+}
+
+ssize_t sendPacket(int fd, const PayloadChain& chain, size_t offset, int flags)
+{
+    enum { MaxIov = IOV_MAX < 1024 ? IOV_MAX : 1024 };
+    struct iovec iov[MaxIov];
+
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = chain.iovecs(offset, iov, MaxIov);
+
+    return ::sendmsg(fd, &msg, MSG_NOSIGNAL | flags);
+}
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* URING OP                                                                   */
+/******************************************************************************/
+
+/** Every op that was handed to the kernel is heap allocated and only freed
+    once its last completion was reaped which means that an op can safely
+    outlive its connection.
+ */
+struct Endpoint::UringOp
+{
+    enum Type { Accept, Connect, Recv, Send };
+
+    UringOp(Type type, int fd, ConnId id) :
+        type(type), fd(fd), id(id), cancelled(false)
+    {}
+
+    Type type;
+    int fd;
+    ConnId id; // 0 for ops that don't belong to a connection.
+    bool cancelled;
+
+    // Send only: the payloads are moved out of the send queue for the duration
+    // of the write and whatever isn't written is put back at the front.
+    std::vector<QueuedPayload> batch;
+    std::vector<struct iovec> iov;
+    struct msghdr msg;
+};
+
+
 /******************************************************************************/
 /* ENDPOINT BASE                                                              */
 /******************************************************************************/
 
 Endpoint::
-Endpoint()
+Endpoint(IoBackend backend) :
+    recvBufferSize_(DefaultRecvBufferSize), maxFrameSize_(DefaultMaxFrameSize),
+    lowWatermark(DefaultLowWatermark), highWatermark(DefaultHighWatermark),
+    maxSendQueue_(DefaultMaxSendQueue),
+    cork_(false), inPoll(false), busyPollUs(0), socketBusyPoll_(false),
+    zeroCopyThreshold(0),
+    coalesceMaxFrame(0), coalesceSize_(DefaultCoalesceSize),
+    coalesceDeadlineUs(0), coalesceTimerArmed(false),
+    uringOps(0)
 {
-    init();
+    init(backend);
 }
 
 Endpoint::
-Endpoint(Port listenPort)
+Endpoint(Port listenPort, IoBackend backend) :
+    recvBufferSize_(DefaultRecvBufferSize), maxFrameSize_(DefaultMaxFrameSize),
+    lowWatermark(DefaultLowWatermark), highWatermark(DefaultHighWatermark),
+    maxSendQueue_(DefaultMaxSendQueue),
+    cork_(false), inPoll(false), busyPollUs(0), socketBusyPoll_(false),
+    zeroCopyThreshold(0),
+    coalesceMaxFrame(0), coalesceSize_(DefaultCoalesceSize),
+    coalesceDeadlineUs(0), coalesceTimerArmed(false),
+    uringOps(0)
 {
-    init();
-
-    listenSockets = PassiveSockets(listenPort);
-    for (int fd : listenSockets.fds())
-        poller.add(fd, EPOLLET | EPOLLIN);
+    init(backend);
+    listen(listenPort);
 }
 
 void
 Endpoint::
-init()
+init(IoBackend backend)
 {
     using namespace std::placeholders;
 
+    if (backend == UringBackend) initUring();
+
     poller.add(disconnectQueueFd.fd());
+    poller.add(corkQueueFd.fd());
+
+    coalesceTimer.onTimer = [=] (uint64_t) {
+        coalesceTimerArmed = false;
+        flushCoalesced();
+    };
+    poller.add(coalesceTimer.fd());
 
-    typedef void (Endpoint::*SendFn) (int, Payload&&);
+    typedef void (Endpoint::*SendFn) (ConnId, Payload&&);
     sends.onOperation = std::bind((SendFn)&Endpoint::send, this, _1, _2);
     poller.add(sends.fd());
 
-    typedef void (Endpoint::*MulticastFn) (const SortedVector<int>&, Payload&&);
+    typedef void (Endpoint::*MulticastFn) (
+            const SortedVector<ConnId>&, Payload&&);
     multicasts.onOperation = std::bind((MulticastFn)&Endpoint::multicast, this, _1, _2);
     poller.add(multicasts.fd());
 
@@ -54,15 +163,29 @@ init()
     broadcasts.onOperation = std::bind((BroadcastFn)&Endpoint::broadcast, this, _1);
     poller.add(broadcasts.fd());
 
-    typedef void (Endpoint::*ConnectFn) (Socket&&);
-    connects.onOperation = std::bind((ConnectFn)&Endpoint::connect, this, _1);
+    typedef void (Endpoint::*ChainSendFn) (ConnId, PayloadChain&&);
+    chainSends.onOperation =
+        std::bind((ChainSendFn)&Endpoint::send, this, _1, _2);
+    poller.add(chainSends.fd());
+
+    typedef void (Endpoint::*ChainMulticastFn) (
+            const SortedVector<ConnId>&, PayloadChain&&);
+    chainMulticasts.onOperation =
+        std::bind((ChainMulticastFn)&Endpoint::multicast, this, _1, _2);
+    poller.add(chainMulticasts.fd());
+
+    typedef void (Endpoint::*ChainBroadcastFn) (PayloadChain&&);
+    chainBroadcasts.onOperation =
+        std::bind((ChainBroadcastFn)&Endpoint::broadcast, this, _1);
+    poller.add(chainBroadcasts.fd());
+
+    connects.onOperation = std::bind(&Endpoint::doConnect, this, _1, _2);
     poller.add(connects.fd());
 
-    typedef void (Endpoint::*DisconnectFn) (int);
-    disconnects.onOperation = std::bind((DisconnectFn)&Endpoint::doDisconnect, this, _1);
+    disconnects.onOperation = std::bind(&Endpoint::disconnect, this, _1);
     poller.add(disconnects.fd());
 
-    onError = [=] (int, int errnum) {
+    onError = [=] (ConnId, int errnum) {
         if (errnum == ECONNRESET || errnum == EPIPE) return true;
 
         auto errStr = checkErrnoString(errnum, "Endpoint.onError");
@@ -77,14 +200,17 @@ Endpoint::
     // The extra step is required to not invalidate our iterator
     std::vector<int> toDisconnect;
     for (const auto& connection : connections)
-        toDisconnect.push_back(connection.first);
+        toDisconnect.push_back(connection.fd);
 
     doDisconnect(std::move(disconnectQueue));
     for (int fd : toDisconnect)
         doDisconnect(fd);
 
-    for (int fd : listenSockets.fds())
-        poller.del(fd);
+    if (uring) closeUring();
+    else {
+        for (int fd : listenSockets.fds())
+            poller.del(fd);
+    }
 }
 
 void
@@ -95,23 +221,78 @@ stopPolling()
 
     doDisconnect(std::move(disconnectQueue));
     sends.poll();
+    multicasts.poll();
     broadcasts.poll();
+    chainSends.poll();
+    chainMulticasts.poll();
+    chainBroadcasts.poll();
     connects.poll();
     disconnects.poll();;
+    flushCoalesced();
+    flushCorked();
 }
 
-template<typename Payload>
+template<typename Data>
 void
 Endpoint::
-dropPayload(int fd, Payload&& data) const
+dropPayload(ConnId id, Data&& data) const
 {
     if (!onDroppedPayload) return;
 
     // This extra step ensures that any lvalue references are first copied
-    // before being moved for the callback.
-    Payload tmpData = std::forward<Payload>(data);
+    // before being moved for the callback. Chains are flattened along the way.
+    Payload tmpData = toPayload(std::forward<Data>(data));
+
+    onDroppedPayload(id, std::move(tmpData));
+}
+
+/** Coalesced payloads are split back into their frames and only the frames
+    that weren't entirely written are dropped.
+ */
+void
+Endpoint::
+dropQueued(ConnId id, QueuedPayload&& entry) const
+{
+    if (!onDroppedPayload) return;
+
+    if (!entry.data) {
+        dropPayload(id, entry.chain);
+        return;
+    }
+
+    if (!entry.coalesced) {
+        dropPayload(id, std::move(entry.data));
+        return;
+    }
+
+    const uint8_t* it = entry.data.cbegin();
+    const uint8_t* last = entry.data.cend();
+    const uint8_t* written = entry.first();
+
+    while (it < last) {
+        size_t size;
+        const uint8_t* first = Payload::readHeader(it, last, size);
+        assert(first && size_t(last - first) >= size);
+
+        it = first + size;
+        if (it > written) dropPayload(id, Payload(first, it));
+    }
+}
+
+/** Only valid on the polling thread. */
+Endpoint::ConnectionState*
+Endpoint::
+find(ConnId id)
+{
+    ConnectionState* conn = connections.find(connFd(id));
+    return conn && conn->id == id ? conn : nullptr;
+}
 
-    onDroppedPayload(fd, std::move(tmpData));
+const Endpoint::ConnectionState*
+Endpoint::
+find(ConnId id) const
+{
+    return const_cast<Endpoint*>(this)->find(id);
 }
 
 
@@ -119,49 +300,132 @@ void
 Endpoint::
 poll(int timeoutMs)
 {
-    while(poller.poll(timeoutMs)) {
+    inPoll = true;
+    auto pollGuard = guard([&] { inPoll = false; });
+
+    while(wait(timeoutMs)) {
 
         struct epoll_event ev = poller.next();
 
-        if (connections.count(ev.data.fd)) {
+        if (ConnectionState* conn = connections.find(ev.data.fd)) {
 
             if (ev.events & EPOLLERR) {
-                auto& conn = connections[ev.data.fd];
-
-                int err = conn.socket.error();
-
-                if (!err) continue;
-                else if (!onError || onError(ev.data.fd, err))
-                    disconnect(ev.data.fd);
+                int err = conn->socket.error();
+
+                // Zero copy completions also come in as errors.
+                if (!err && conn->zeroCopy)
+                    reapZeroCopy(ev.data.fd, conn->zeroCopyPending);
+                else if (!err) continue;
+                else if (!onError || onError(conn->id, err))
+                    disconnect(conn->id);
             }
 
             if (ev.events & EPOLLOUT) flushQueue(ev.data.fd);
             if (ev.events & EPOLLIN) recvPayload(ev.data.fd);
         }
 
+        else if (LingeringSocket* sock = lingering.find(ev.data.fd))
+            reapLingering(ev.data.fd, *sock);
+
+        else if (uring && ev.data.fd == uring.fd()) reapUring();
+
         else if (listenSockets.test(ev.data.fd)) accept(ev.data.fd);
 
         else if (ev.data.fd == disconnectQueueFd.fd())
             doDisconnect(std::move(disconnectQueue));
 
+        // flushCorked is called below so all we need to do is clear the fd.
+        else if (ev.data.fd == corkQueueFd.fd())
+            while (corkQueueFd.poll());
+
+        else if (ev.data.fd == coalesceTimer.fd()) coalesceTimer.poll();
+
         else if (ev.data.fd == sends.fd())       sends.poll(DeferCap);
+        else if (ev.data.fd == multicasts.fd())  multicasts.poll(DeferCap);
         else if (ev.data.fd == broadcasts.fd())  broadcasts.poll(DeferCap);
+        else if (ev.data.fd == chainSends.fd())  chainSends.poll(DeferCap);
+        else if (ev.data.fd == chainMulticasts.fd())
+            chainMulticasts.poll(DeferCap);
+        else if (ev.data.fd == chainBroadcasts.fd())
+            chainBroadcasts.poll(DeferCap);
         else if (ev.data.fd == connects.fd())    connects.poll(DeferCap);
-        else if (ev.data.fd == disconnects.fd()) disconnects.poll(DeferCap);
+
+        // Connects are drained first since the handle of a connect that's
+        // still sitting in its queue would otherwise be unknown to the
+        // disconnect which would then leak the connection.
+        else if (ev.data.fd == disconnects.fd()) {
+            connects.poll();
+            disconnects.poll(DeferCap);
+        }
 
         else assert(false);
     }
+
+    if (!coalesceDeadlineUs) flushCoalesced();
+    flushCorked();
+    if (uring) uring.submit();
+}
+
+
+/** Waits for the next event while honoring the busy poll budget. Note that the
+    budget restarts on every event which means that a steady trickle of events
+    keeps us spinning.
+ */
+bool
+Endpoint::
+wait(int timeoutMs)
+{
+    if (poller.ready()) return true;
+
+    // We're about to go back to the kernel for more events so it's a good time
+    // to write out whatever was batched up while processing the last ones.
+    if (!coalesceDeadlineUs) flushCoalesced();
+    flushCorked();
+    if (uring) uring.submit();
+
+    if (!busyPollUs || !timeoutMs) return poller.poll(timeoutMs);
+
+    typedef std::chrono::steady_clock Clock;
+    auto deadline = Clock::now() + std::chrono::microseconds(busyPollUs);
+
+    do {
+        if (poller.poll(0)) {
+            stats_.productiveSpins++;
+            return true;
+        }
+        stats_.emptySpins++;
+    } while (Clock::now() < deadline);
+
+    return poller.poll(timeoutMs);
 }
 
 
 void
 Endpoint::
-listen(Port listenPort)
+listen(Port listenPort, bool reusePort)
 {
     assert(!isPollThread.isPolling());
 
-    for (int fd : listenSockets.fds()) poller.del(fd);
-    listenSockets = PassiveSockets(listenPort);
+    if (uring) {
+        for (UringOp* op : acceptOps) {
+            op->cancelled = true;
+
+            struct io_uring_sqe* sqe = uring.sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = reinterpret_cast<uint64_t>(op);
+        }
+        acceptOps.clear();
+    }
+    else for (int fd : listenSockets.fds()) poller.del(fd);
+
+    listenSockets = PassiveSockets(listenPort, reusePort);
+
+    for (int fd : listenSockets.fds()) {
+        if (uring) armAccept(newUringOp(UringOp::Accept, fd, 0));
+        else poller.add(fd, EPOLLET | EPOLLIN);
+    }
+
+    submitUring();
 }
 
 void
@@ -173,71 +437,103 @@ accept(int fd)
         connect(std::move(socket));
 }
 
-void
+ConnId
 Endpoint::
 connect(Socket&& socket)
 {
-    if (!isPollThread()) {
-        connects.defer(std::move(socket));
-        return;
-    }
+    if (!socket) return 0;
+
+    // Generation 0 is skipped so that 0 is never a valid handle.
+    uint32_t generation = ++nextGeneration;
+    if (!generation) generation = ++nextGeneration;
+
+    ConnId id = makeConnId(socket.fd(), generation);
+
+    if (isPollThread()) doConnect(std::move(socket), id);
+    else connects.defer(std::move(socket), id);
 
+    return id;
+}
+
+void
+Endpoint::
+doConnect(Socket&& socket, ConnId id)
+{
     int fd = socket.fd();
-    poller.add(fd, EPOLLET | EPOLLIN | EPOLLOUT);
+    if (!uring) poller.add(fd, EPOLLET | EPOLLIN | EPOLLOUT);
 
-    auto it = connections.find(fd);
-    assert(it == connections.end());
+    if (socketBusyPoll_) {
+        int val = busyPollUs;
+        int ret = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof val);
+        SLICK_CHECK_ERRNO(
+                !ret || errno == EPERM, "Endpoint.setsockopt.SO_BUSY_POLL");
+    }
 
     ConnectionState connection;
+
+    if (zeroCopyThreshold && !uring) {
+        int val = 1;
+        int ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof val);
+        SLICK_CHECK_ERRNO(
+                !ret || errno == ENOPROTOOPT || errno == EOPNOTSUPP,
+                "Endpoint.setsockopt.SO_ZEROCOPY");
+        connection.zeroCopy = !ret;
+    }
+
     connection.socket = std::move(socket);
-    connections[fd] = std::move(connection);
+    connection.id = id;
+
+    auto& conn = connections.insert(fd, std::move(connection));
+
+    if ((conn.sharedQueuedBytes = sharedQueuedBytes.slot(fd))) {
+        conn.sharedQueuedBytes->bytes.store(0, std::memory_order_relaxed);
+        conn.sharedQueuedBytes->id.store(id, std::memory_order_release);
+    }
+
+    if (uring) {
+        armConnect(conn);
+        armRecv(newUringOp(UringOp::Recv, fd, id));
+        submitUring();
+    }
 }
 
-int
+ConnId
 Endpoint::
 connect(const Address& addr)
 {
-    auto socket = Socket::connect(addr);
-    if (!socket) return 0;
-
-    int fd = socket.fd();
-    connect(std::move(socket));
-    return fd;
+    return connect(Socket::connect(addr));
 }
 
-int
+ConnId
 Endpoint::
 connect(const NodeAddress& node)
 {
-    auto socket = Socket::connect(node);
-    if (!socket) return 0;
-
-    int fd = socket.fd();
-    connect(std::move(socket));
-    return fd;
+    return connect(Socket::connect(node));
 }
 
 void
 Endpoint::
-disconnect(int fd)
+disconnect(ConnId id)
 {
     if (!isPollThread.isPolling()) {
-        doDisconnect(fd);
+        if (find(id)) doDisconnect(connFd(id));
         return;
     }
 
     if (!isPollThread()) {
-        disconnects.defer(fd);
+        disconnects.defer(id);
         return;
     }
 
-    auto it = connections.find(fd);
-    if (it == connections.end() || !it->second.connected || it->second.disconnected)
-        return;
+    // Connections that are still being established can also be cancelled.
+    // They're reported through onLostConnection like a failed connect would
+    // be so that callers can release whatever they tied to the id.
+    ConnectionState* conn = find(id);
+    if (!conn || conn->disconnected) return;
 
-    it->second.disconnected = true;
+    conn->disconnected = true;
 
-    disconnectQueue.emplace_back(fd);
+    disconnectQueue.emplace_back(connFd(id));
     disconnectQueueFd.signal();
 }
 
@@ -253,64 +549,181 @@ void
 Endpoint::
 doDisconnect(int fd)
 {
-    auto it = connections.find(fd);
-    assert(it != connections.end());
+    ConnectionState* conn = connections.find(fd);
+    assert(conn);
+
+    ConnId id = conn->id;
 
     if (onDroppedPayload) {
-        for (auto& pl : it->second.sendQueue)
-            dropPayload(fd, std::move(pl.first));
+        for (auto& entry : conn->sendQueue)
+            dropQueued(id, std::move(entry));
+
+        if (conn->coalescedBytes) dropQueued(id, takeCoalesced(*conn));
     }
 
-    poller.del(fd);
+    // The kernel may still be sending straight out of these payloads and the
+    // pools would hand out their buffers again as soon as they're released.
+    if (conn->sharedQueuedBytes)
+        conn->sharedQueuedBytes->id.store(0, std::memory_order_release);
+
+    if (!conn->zeroCopyPending.empty())
+        reapZeroCopy(fd, conn->zeroCopyPending);
+
+    if (!conn->zeroCopyPending.empty()) {
+        shutdown(fd, SHUT_RDWR);
+
+        LingeringSocket sock;
+        sock.socket = std::move(conn->socket);
+        sock.zeroCopyPending = std::move(conn->zeroCopyPending);
+        lingering.insert(fd, std::move(sock));
+    }
+    else if (!uring) poller.del(fd);
+
     connections.erase(fd);
 
-    if (onLostConnection) onLostConnection(fd);
+    if (onLostConnection) onLostConnection(id);
 }
 
 
-uint8_t*
+/** Hands out a complete frame to the user's callback.
+
+    Since the callbacks are free to disconnect the connection, the connection
+    is looked up again after each dispatch. Returns false if the connection is
+    gone in which case the caller should stop touching it.
+ */
+bool
+Endpoint::
+dispatchFrame(ConnId id, const uint8_t* first, const uint8_t* last)
+{
+    if (onPayloadView) onPayloadView(id, first, last);
+    else onPayload(id, Payload(first, last));
+
+    return find(id);
+}
+
+bool
 Endpoint::
-processRecvBuffer(uint8_t* first, uint8_t* last, std::vector<Payload>& queue)
+dispatchFrame(ConnId id, Payload&& data)
 {
-    uint8_t* it = first;
+    if (onPayloadView) onPayloadView(id, data.cbegin(), data.cend());
+    else onPayload(id, std::move(data));
 
-    while (it < last) {
-        size_t leftover = last - it;
-        Payload data = Payload::read(it, leftover);
+    return find(id);
+}
+
+
+/** Returns false if the connection should be dropped because the arena ran
+    out of buffers.
+ */
+bool
+Endpoint::
+initRecvBuffer(ConnectionState& conn)
+{
+    if (conn.recvBuffer) return true;
+
+    if (!arena) conn.recvBuffer = RecvBuffer(recvBufferSize_);
+    else conn.recvBuffer = RecvBuffer(arena);
+
+    return bool(conn.recvBuffer);
+}
+
+
+/** Parses and dispatches all the complete frames sitting in the receive buffer
+    of the connection. A frame that can't fit in the buffer is moved into its
+    own payload and the rest of it is read directly into it by recvPayload.
+
+    Returns false if the connection is gone or should no longer be read from.
+ */
+bool
+Endpoint::
+processRecvBuffer(int fd)
+{
+    ConnectionState* conn = connections.find(fd);
+    if (!conn) return false;
+
+    while (true) {
+        auto& buffer = conn->recvBuffer;
 
-        if (!data.packetSize()) {
-            std::copy(it, last, first);
-            return first + leftover;
+        size_t size;
+        const uint8_t* first =
+            Payload::readHeader(buffer.begin(), buffer.end(), size);
+
+        if (!first) {
+            buffer.reserve(Payload::MaxHeaderSize);
+            return true;
         }
 
-        it += data.packetSize();
-        assert(data.packetSize());
-        queue.emplace_back(std::move(data));
-    }
+        if (size > maxFrameSize_) {
+            disconnect(conn->id);
+            return false;
+        }
+
+        size_t headerSize = first - buffer.begin();
+        size_t frameSize = headerSize + size;
+
+        if (frameSize > buffer.capacity()) {
+            size_t copied = buffer.end() - first;
+            assert(copied < size);
+
+            conn->largeFrame = Payload(size);
+            std::copy(first, buffer.end(), conn->largeFrame.begin());
+            conn->largeFrameRecv = copied;
+
+            buffer.consume(buffer.size());
+            return true;
+        }
+
+        if (buffer.size() < frameSize) {
+            buffer.reserve(frameSize);
+            return true;
+        }
+
+        // The bytes stay put until the next recv on this connection so it's
+        // safe to consume them before handing them out.
+        buffer.consume(frameSize);
+        if (!dispatchFrame(conn->id, first, first + size)) return false;
 
-    assert(it == last);
-    return first;
+        conn = connections.find(fd);
+    }
 }
 
 void
 Endpoint::
 recvPayload(int fd)
 {
-    auto connIt = connections.find(fd);
-    if (connIt == connections.end()) return;
-    auto& conn = connIt->second;
-
-    enum { bufferLength = 1U << 16 };
-    uint8_t buffer[bufferLength];
-    uint8_t* bufferIt = buffer;
-
-    std::vector<Payload> queue;
-    queue.reserve(1 << 5);
+    ConnectionState* connPtr = connections.find(fd);
+    if (!connPtr) return;
 
+    ConnId id = connPtr->id;
     bool doDisconnect = false;
 
     while (true) {
-        ssize_t read = recv(fd, bufferIt, (buffer + bufferLength) - bufferIt, 0);
+        auto& conn = *connPtr;
+        auto& buffer = conn.recvBuffer;
+
+        uint8_t* dest;
+        size_t destSize;
+
+        if (conn.largeFrame) {
+            dest = conn.largeFrame.begin() + conn.largeFrameRecv;
+            destSize = conn.largeFrame.size() - conn.largeFrameRecv;
+        }
+        else {
+            if (!initRecvBuffer(conn)) {
+                doDisconnect = true;
+                break;
+            }
+
+            // Avoids issuing tiny recv calls when a partial frame is stuck at
+            // the end of the buffer.
+            if (buffer.available() < buffer.capacity() / 4) buffer.compact();
+
+            dest = buffer.tail();
+            destSize = buffer.available();
+        }
+        assert(destSize);
+
+        ssize_t read = recv(fd, dest, destSize, 0);
 
         if (read < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) break;
@@ -324,60 +737,151 @@ recvPayload(int fd)
         }
 
         conn.bytesRecv += read;
-        bufferIt = processRecvBuffer(buffer, bufferIt + read, queue);
-        assert(bufferIt < (buffer + bufferLength));
+
+        if (conn.largeFrame) {
+            conn.largeFrameRecv += read;
+            if (conn.largeFrameRecv < conn.largeFrame.size()) continue;
+
+            Payload data = std::move(conn.largeFrame);
+            conn.largeFrameRecv = 0;
+            if (!dispatchFrame(id, std::move(data))) return;
+        }
+
+        else {
+            buffer.commit(read);
+            if (!processRecvBuffer(fd)) return;
+        }
+
+        connPtr = connections.find(fd);
+    }
+
+    if (doDisconnect) disconnect(id);
+}
+
+
+void
+Endpoint::
+pushToSendQueue(Endpoint::ConnectionState& conn, QueuedPayload&& entry)
+{
+    size_t bytes = entry.size();
+
+    if (conn.queuedBytes && conn.queuedBytes + bytes > maxSendQueue_) {
+        dropQueued(conn.id, std::move(entry));
+        return;
     }
 
-    for (auto& data : queue)
-        onPayload(fd, std::move(data));
+    conn.sendQueue.emplace_back(std::move(entry));
+    conn.queuedBytes += bytes;
+    publishQueuedBytes(conn);
+
+    if (conn.backpressure || conn.queuedBytes < highWatermark) return;
 
-    if (doDisconnect && connections.count(fd))
-        disconnect(fd);
+    conn.backpressure = true;
+    if (onBackpressure) onBackpressure(conn.id, true);
 }
 
+void
+Endpoint::
+releaseBackpressure(ConnectionState& conn)
+{
+    if (!conn.backpressure || conn.queuedBytes > lowWatermark) return;
+
+    conn.backpressure = false;
+    if (onBackpressure) onBackpressure(conn.id, false);
+}
 
-template<typename Payload>
 void
 Endpoint::
-pushToSendQueue(Endpoint::ConnectionState& conn, Payload&& data, size_t offset)
+publishQueuedBytes(ConnectionState& conn)
+{
+    if (!conn.sharedQueuedBytes) return;
+    conn.sharedQueuedBytes->bytes.store(
+            conn.queuedBytes, std::memory_order_relaxed);
+}
+
+/** The id is checked on both sides of the read so that we don't report the
+    bytes of a connection that reused the fd in the meantime.
+ */
+size_t
+Endpoint::
+pendingBytes(ConnId id) const
 {
-    enum { MaxQueueSize = 1 << 8 };
+    const SharedQueuedBytes* shared = sharedQueuedBytes.find(connFd(id));
+    if (!shared || shared->id.load(std::memory_order_acquire) != id) return 0;
 
-    if (conn.sendQueue.size() < MaxQueueSize)
-        conn.sendQueue.emplace_back(std::forward<Payload>(data), offset);
+    size_t bytes = shared->bytes.load(std::memory_order_relaxed);
 
-    else dropPayload(conn.socket.fd(), std::forward<Payload>(data));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return shared->id.load(std::memory_order_relaxed) == id ? bytes : 0;
 }
 
-template<typename Payload>
+template<typename Data>
 bool
 Endpoint::
-sendTo(Endpoint::ConnectionState& conn, Payload&& data, size_t offset)
+sendTo(Endpoint::ConnectionState& conn, Data&& data)
 {
-    if (conn.disconnected) {
-        dropPayload(conn.socket.fd(), std::forward<Payload>(data));
+    typedef typename std::decay<Data>::type DataT;
+
+    if (conn.disconnected || data.size() > maxFrameSize_) {
+        dropPayload(conn.id, std::forward<Data>(data));
         return true;
     }
 
+    if (coalesceMaxFrame) {
+        if (appendCoalesced(conn, data)) return true;
+
+        // Anything that can't be coalesced has to wait for the frames that
+        // were coalesced before it.
+        if (conn.coalescedBytes) {
+            flushCoalesced(conn);
+            if (conn.disconnected) {
+                dropPayload(conn.id, std::forward<Data>(data));
+                return true;
+            }
+        }
+    }
+
     if (!conn.writable) {
-        pushToSendQueue(conn, std::forward<Payload>(data), 0);
+        pushToSendQueue(conn, QueuedPayload(DataT(std::forward<Data>(data)), 0));
+        return true;
+    }
+
+    // io_uring sends are always batched until the end of the poll iteration.
+    if (cork_ || uring) {
+        pushToSendQueue(conn, QueuedPayload(DataT(std::forward<Data>(data)), 0));
+        markCorked(conn);
         return true;
     }
 
-    const uint8_t* start = data.packet() + offset;
-    ssize_t size = data.packetSize() - offset;
+    size_t offset = 0;
+    ssize_t size = data.packetSize();
     assert(size > 0);
 
     while (true) {
 
-        ssize_t sent = ::send(conn.socket.fd(), start, size, MSG_NOSIGNAL);
+        bool zeroCopy =
+            !std::is_same<DataT, PayloadChain>::value && isZeroCopy(conn, size);
+        int flags = zeroCopy ? MSG_ZEROCOPY : 0;
+
+        ssize_t sent = sendPacket(conn.socket.fd(), data, offset, flags);
         assert(sent); // No idea what to do with a return value of 0.
 
+        if (sent < 0 && zeroCopy && errno == ENOBUFS) {
+            stats_.zeroCopyFallbacks++;
+            zeroCopy = false;
+            sent = sendPacket(conn.socket.fd(), data, offset, 0);
+        }
+
+        stats_.sendCalls++;
         if (sent > 0) conn.bytesSent += sent;
+        if (sent > 0 && zeroCopy) holdZeroCopy(conn, QueuedPayload(DataT(data), 0));
 
-        if (sent == size) return true;
+        if (sent == size) {
+            stats_.sentPayloads++;
+            return true;
+        }
         if (sent >= 0 && sent < size) {
-            start += sent;
+            offset += sent;
             size -= sent;
             assert(size > 0);
             continue;
@@ -388,8 +892,8 @@ sendTo(Endpoint::ConnectionState& conn, Payload&& data, size_t offset)
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             conn.writable = false;
 
-            size_t pos = data.packetSize() - size;
-            pushToSendQueue(conn, std::forward<Payload>(data), pos);
+            QueuedPayload entry(DataT(std::forward<Data>(data)), offset);
+            pushToSendQueue(conn, std::move(entry));
             return true;
         }
 
@@ -399,76 +903,56 @@ sendTo(Endpoint::ConnectionState& conn, Payload&& data, size_t offset)
 }
 
 
+template<typename Data>
 void
 Endpoint::
-send(int fd, Payload&& data)
+sendNow(ConnId id, Data&& data)
 {
-    if (!isPollThread()) {
-        // \todo Need a way to avoid this copy.
-        if (!sends.tryDefer(fd, data))
-            dropPayload(fd, std::move(data));
-        return;
-    }
-
-    auto it = connections.find(fd);
+    ConnectionState* conn = find(id);
 
-    if (it == connections.end()) {
-        dropPayload(fd, std::move(data));
+    if (!conn) {
+        dropPayload(id, std::move(data));
         return;
     }
 
-    if (!sendTo(it->second, std::move(data))) {
-        dropPayload(fd, std::move(data));
-        disconnect(it->first);
+    if (!sendTo(*conn, std::move(data))) {
+        dropPayload(id, std::move(data));
+        disconnect(id);
     }
 }
 
+template<typename Data>
 void
 Endpoint::
-multicast(const SortedVector<int>& fds, Payload&& data)
+multicastNow(const SortedVector<ConnId>& ids, const Data& data)
 {
-    if (fds.size() == 1) {
-        send(fds.front(), std::move(data));
-        return;
-    }
+    for (ConnId id : ids) {
+        ConnectionState* conn = find(id);
 
-    if (!isPollThread()) {
-        if (!multicasts.tryDefer(fds, data)) {
-            for (int fd : fds)
-                dropPayload(fd, std::move(data));
-        }
-        return;
-    }
-
-    for (int fd : fds) {
-        auto it = connections.find(fd);
-
-        if (it == connections.end()) {
-            dropPayload(fd, data);
+        if (!conn) {
+            dropPayload(id, data);
             continue;
         }
 
-        if (!sendTo(it->second, data)) {
-            dropPayload(fd, data);
-            disconnect(fd);
+        if (!sendTo(*conn, data)) {
+            dropPayload(id, data);
+            disconnect(id);
         }
     }
 }
 
+template<typename Data>
 void
 Endpoint::
-broadcast(Payload&& data)
+broadcastNow(const Data& data)
 {
-    if (!isPollThread()) {
-        if (!broadcasts.tryDefer(data))
-            dropPayload(-1, std::move(data));
-        return;
-    }
+    // Indexed because the callbacks can add connections behind our back.
+    for (size_t i = 0; i < connections.size(); ++i) {
+        auto& conn = *connections[i].value;
 
-    for (auto& conn : connections) {
-        if (!sendTo(conn.second, data)) {
-            dropPayload(conn.first, data);
-            disconnect(conn.second.socket.fd());
+        if (!sendTo(conn, data)) {
+            dropPayload(conn.id, data);
+            disconnect(conn.id);
         }
     }
 }
@@ -476,33 +960,844 @@ broadcast(Payload&& data)
 
 void
 Endpoint::
-flushQueue(int fd)
+send(ConnId id, Payload&& data)
 {
-    auto it = connections.find(fd);
-    if (it == connections.end()) return;
+    if (!isPollThread()) {
+        // Copying only bumps the ref count of the payload.
+        if (!sends.tryDefer(id, data))
+            dropPayload(id, std::move(data));
+        return;
+    }
 
-    auto& conn = it->second;
+    sendNow(id, std::move(data));
+}
 
-    if (!conn.connected) {
-        if (onNewConnection) onNewConnection(conn.socket.fd());
-        conn.connected = true;
+void
+Endpoint::
+multicast(const SortedVector<ConnId>& ids, Payload&& data)
+{
+    if (ids.size() == 1) {
+        send(ids.front(), std::move(data));
+        return;
     }
-    conn.writable = true;
 
+    if (!isPollThread()) {
+        if (!multicasts.tryDefer(ids, data)) {
+            for (ConnId id : ids)
+                dropPayload(id, std::move(data));
+        }
+        return;
+    }
+
+    multicastNow(ids, data);
+}
+
+void
+Endpoint::
+broadcast(Payload&& data)
+{
+    if (!isPollThread()) {
+        if (!broadcasts.tryDefer(data))
+            dropPayload(0, std::move(data));
+        return;
+    }
+
+    broadcastNow(data);
+}
+
+
+void
+Endpoint::
+send(ConnId id, PayloadChain&& data)
+{
+    if (!isPollThread()) {
+        if (!chainSends.tryDefer(id, data))
+            dropPayload(id, data);
+        return;
+    }
+
+    sendNow(id, std::move(data));
+}
+
+void
+Endpoint::
+multicast(const SortedVector<ConnId>& ids, PayloadChain&& data)
+{
+    if (ids.size() == 1) {
+        send(ids.front(), std::move(data));
+        return;
+    }
+
+    if (!isPollThread()) {
+        if (!chainMulticasts.tryDefer(ids, data)) {
+            for (ConnId id : ids)
+                dropPayload(id, data);
+        }
+        return;
+    }
+
+    multicastNow(ids, data);
+}
+
+void
+Endpoint::
+broadcast(PayloadChain&& data)
+{
+    if (!isPollThread()) {
+        if (!chainBroadcasts.tryDefer(data))
+            dropPayload(0, data);
+        return;
+    }
+
+    broadcastNow(data);
+}
+
+
+void
+Endpoint::
+flushQueue(int fd)
+{
+    ConnectionState* connPtr = connections.find(fd);
+    if (!connPtr) return;
+
+    auto& conn = *connPtr;
+
+    if (!conn.connected) {
+        if (onNewConnection) onNewConnection(conn.id);
+        conn.connected = true;
+    }
+    conn.writable = true;
+
+    writeOut(conn);
+}
+
+void
+Endpoint::
+writeOut(ConnectionState& conn)
+{
+    if (uring) armSend(conn);
+    else if (!writeQueue(conn)) abortQueue(conn);
+    else releaseBackpressure(conn);
+}
+
+void
+Endpoint::
+abortQueue(ConnectionState& conn)
+{
     auto queue = std::move(conn.sendQueue);
+    conn.queuedBytes = 0;
+    publishQueuedBytes(conn);
+
+    for (auto& entry : queue)
+        dropQueued(conn.id, std::move(entry));
+
+    disconnect(conn.id);
+}
+
+
+/** Writes as much of the send queue as the socket will take by gathering the
+    queued payloads into as few sendmsg calls as possible. The offset of each
+    queue entry indicates how much of the payload was written in a previous
+    call and is updated if we stop in the middle of a payload.
+
+    Returns false if the connection was reset in which case whatever couldn't
+    be written is left in the queue.
+ */
+bool
+Endpoint::
+writeQueue(ConnectionState& conn)
+{
+    auto& queue = conn.sendQueue;
+    size_t done = 0;
+
+    auto eraseDone = guard([&] {
+                queue.erase(queue.begin(), queue.begin() + done);
+            });
+
+    enum { MaxIov = IOV_MAX < 1024 ? IOV_MAX : 1024 };
+    struct iovec iov[MaxIov];
+
+    while (conn.writable && done < queue.size()) {
+
+        // Zero copy payloads get a call of their own so that we know exactly
+        // which payload to hold on to for each completion.
+        bool zeroCopy = isZeroCopy(conn, queue[done]);
+
+        // Chains take up more than one iovec and can end up being cut short
+        // in which case the rest is picked up by the next call.
+        size_t n = 0;
+        if (zeroCopy) n = queue[done].iovecs(iov, MaxIov);
+        else {
+            for (size_t i = done; i < queue.size() && n < MaxIov; ++i) {
+                if (isZeroCopy(conn, queue[i])) break;
+                n += queue[i].iovecs(iov + n, MaxIov - n);
+            }
+        }
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        int flags = MSG_NOSIGNAL | (zeroCopy ? MSG_ZEROCOPY : 0);
+        ssize_t sent = ::sendmsg(conn.socket.fd(), &msg, flags);
+        assert(sent); // No idea what to do with a return value of 0.
+
+        if (sent < 0 && zeroCopy && errno == ENOBUFS) {
+            stats_.zeroCopyFallbacks++;
+            zeroCopy = false;
+            sent = ::sendmsg(conn.socket.fd(), &msg, MSG_NOSIGNAL);
+        }
+
+        stats_.sendCalls++;
+        if (sent > 0 && zeroCopy) holdZeroCopy(conn, QueuedPayload(queue[done]));
+
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn.writable = false;
+                break;
+            }
+
+            if (errno == ECONNRESET || errno == EPIPE) return false;
+            SLICK_CHECK_ERRNO(sent >= 0, "Endpoint.writeQueue.sendmsg");
+        }
+
+        conn.bytesSent += sent;
+        conn.queuedBytes -= sent;
+        publishQueuedBytes(conn);
+
+        size_t left = sent;
+        while (left) {
+            auto& entry = queue[done];
+            size_t size = entry.size();
+
+            if (left < size) {
+                entry.offset += left;
+                break;
+            }
+
+            left -= size;
+            done++;
+            stats_.sentPayloads++;
+        }
+    }
+
+    return true;
+}
+
+
+void
+Endpoint::
+markCorked(ConnectionState& conn)
+{
+    // Keeps the amount of data sitting in the queue and the size of the
+    // vectored write in check.
+    enum { MaxCorked = 1 << 6 };
+
+    if (conn.sendQueue.size() >= MaxCorked) {
+        writeOut(conn);
+        return;
+    }
+
+    if (conn.corked) return;
+    conn.corked = true;
+
+    // Corked sends that happen outside of poll need to wake up the poll loop
+    // or they'd sit in the queue until something else comes along.
+    if (corkQueue.empty() && !inPoll) corkQueueFd.signal();
+    corkQueue.push_back(conn.socket.fd());
+}
+
+void
+Endpoint::
+flushCorked()
+{
+    if (corkQueue.empty()) return;
+
+    std::vector<int> fds = std::move(corkQueue);
+    corkQueue.clear();
+
+    for (int fd : fds) {
+        ConnectionState* connPtr = connections.find(fd);
+        if (!connPtr) continue;
+
+        auto& conn = *connPtr;
+        if (!conn.corked) continue;
+        conn.corked = false;
+
+        if (!conn.writable || conn.disconnected) continue;
+        writeOut(conn);
+    }
+}
+
+
+/** Copies the frame into the coalesce buffer of the connection. Returns false
+    if the frame is too large to be coalesced.
+ */
+template<typename Data>
+bool
+Endpoint::
+appendCoalesced(ConnectionState& conn, const Data& data)
+{
+    size_t size = data.packetSize();
+    if (size > coalesceMaxFrame) return false;
+
+    if (!conn.coalescedBytes) {
+        conn.coalesceBuffer = Payload(coalesceSize_);
+
+        if (coalesceDeadlineUs && !coalesceTimerArmed) {
+            coalesceTimer.setDelay(0, coalesceDeadlineUs / 1000000.0);
+            coalesceTimerArmed = true;
+        }
+
+        // Same as markCorked: we need poll to come around to flush the buffer.
+        else if (!coalesceDeadlineUs && coalesceQueue.empty() && !inPoll)
+            corkQueueFd.signal();
+
+        coalesceQueue.push_back(conn.socket.fd());
+    }
+
+    copyPacket(data, conn.coalesceBuffer.begin() + conn.coalescedBytes);
+
+    conn.coalescedBytes += size;
+    stats_.coalescedPayloads++;
+
+    if (coalesceSize_ - conn.coalescedBytes < coalesceMaxFrame)
+        flushCoalesced(conn);
+
+    return true;
+}
+
+Endpoint::QueuedPayload
+Endpoint::
+takeCoalesced(ConnectionState& conn)
+{
+    size_t size = conn.coalescedBytes;
+    conn.coalescedBytes = 0;
+
+    Payload data = std::move(conn.coalesceBuffer);
+    data.shrink(size);
+
+    return QueuedPayload(std::move(data), Payload::headerSize(size), true);
+}
+
+/** Moves the coalesce buffer to the send queue where it's written out like
+    any other payload.
+ */
+void
+Endpoint::
+flushCoalesced(ConnectionState& conn)
+{
+    if (!conn.coalescedBytes) return;
+
+    QueuedPayload entry = takeCoalesced(conn);
+
+    if (conn.disconnected) {
+        dropQueued(conn.id, std::move(entry));
+        return;
+    }
+
+    pushToSendQueue(conn, std::move(entry));
+
+    if (!conn.writable) return;
+    if (cork_ || uring) markCorked(conn);
+    else writeOut(conn);
+}
+
+void
+Endpoint::
+flushCoalesced()
+{
+    if (coalesceQueue.empty()) return;
+
+    std::vector<int> fds = std::move(coalesceQueue);
+    coalesceQueue.clear();
+
+    // A connection can show up more than once if its buffer was flushed
+    // early but that's harmless since the buffer is then empty.
+    for (int fd : fds) {
+        ConnectionState* conn = connections.find(fd);
+        if (conn) flushCoalesced(*conn);
+    }
+}
+
+
+/******************************************************************************/
+/* ZERO COPY                                                                  */
+/******************************************************************************/
+
+bool
+Endpoint::
+isZeroCopy(const ConnectionState& conn, size_t size) const
+{
+    return conn.zeroCopy && size >= zeroCopyThreshold;
+}
+
+bool
+Endpoint::
+isZeroCopy(const ConnectionState& conn, const QueuedPayload& entry) const
+{
+    return entry.data && isZeroCopy(conn, entry.size());
+}
+
+/** Every successful MSG_ZEROCOPY send call is numbered by the kernel starting
+    from 0 and the completions refer to these numbers.
+ */
+void
+Endpoint::
+holdZeroCopy(ConnectionState& conn, QueuedPayload&& entry)
+{
+    conn.zeroCopyPending.emplace_back(conn.zeroCopySeq++, std::move(entry));
+    stats_.zeroCopySends++;
+}
 
-    size_t i = 0;
-    for (i = 0; i < queue.size(); ++i) {
-        if (!sendTo(conn, std::move(queue[i].first), queue[i].second))
+/** Each completion covers an inclusive range of send calls. Ranges are usually
+    reported in order but nothing guarantees it.
+ */
+void
+Endpoint::
+reapZeroCopy(int fd, ZeroCopyPending& pending)
+{
+    while (true) {
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 2];
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        ssize_t ret = recvmsg(fd, &msg, MSG_ERRQUEUE);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR) continue;
+            SLICK_CHECK_ERRNO(ret >= 0, "Endpoint.recvmsg.MSG_ERRQUEUE");
+        }
+
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool isErr =
+                (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!isErr) continue;
+
+            auto err = reinterpret_cast<const struct sock_extended_err*>(
+                    CMSG_DATA(cmsg));
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            uint32_t first = err->ee_info;
+            uint32_t last = err->ee_data;
+
+            // Unsigned arithmetic takes care of the sequence wrapping around.
+            auto done = [=] (const std::pair<uint32_t, QueuedPayload>& entry) {
+                return entry.first - first <= last - first;
+            };
+
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                stats_.zeroCopyCopied += last - first + 1;
+
+            pending.erase(
+                    std::remove_if(pending.begin(), pending.end(), done),
+                    pending.end());
+        }
+    }
+}
+
+void
+Endpoint::
+reapLingering(int fd, LingeringSocket& sock)
+{
+    reapZeroCopy(fd, sock.zeroCopyPending);
+    if (!sock.zeroCopyPending.empty()) return;
+
+    poller.del(fd);
+    lingering.erase(fd);
+}
+
+
+/******************************************************************************/
+/* URING                                                                      */
+/******************************************************************************/
+
+void
+Endpoint::
+initUring()
+{
+    enum { Entries = 1 << 8, Buffers = 1 << 8, BufferSize = 1 << 14 };
+
+    // Leaving the ring uninitialized means that we'll fall back on epoll.
+    if (!uring.init(Entries, Buffers, BufferSize)) return;
+
+    poller.add(uring.fd());
+}
+
+/** The kernel could still be writing to the memory held by our ops so we
+    can't go anywhere until they're all accounted for. By now all the sockets
+    are shutdown so only the accepts need an explicit nudge.
+ */
+void
+Endpoint::
+closeUring()
+{
+    for (UringOp* op : acceptOps) op->cancelled = true;
+    acceptOps.clear();
+
+    struct io_uring_sqe* sqe = uring.sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+
+    while (uringOps) {
+        uring.submit(1);
+        reapUring();
+    }
+
+    poller.del(uring.fd());
+}
+
+Endpoint::UringOp*
+Endpoint::
+newUringOp(int type, int fd, ConnId id)
+{
+    uringOps++;
+    return new UringOp(UringOp::Type(type), fd, id);
+}
+
+void
+Endpoint::
+freeUringOp(UringOp* op)
+{
+    assert(uringOps);
+    uringOps--;
+    delete op;
+}
+
+/** Outside of poll there's no guarantee that anyone will submit on our behalf
+    any time soon.
+ */
+void
+Endpoint::
+submitUring()
+{
+    if (uring && !inPoll) uring.submit();
+}
+
+Endpoint::ConnectionState*
+Endpoint::
+findConnection(const UringOp& op)
+{
+    return find(op.id);
+}
+
+
+void
+Endpoint::
+reapUring()
+{
+    uring.reap([&] (const struct io_uring_cqe& cqe) {
+                // Cancellations and recycled buffers don't carry an op.
+                if (!cqe.user_data) return;
+
+                UringOp* op = reinterpret_cast<UringOp*>(cqe.user_data);
+                switch (op->type) {
+                case UringOp::Accept:  onUringAccept(op, cqe); break;
+                case UringOp::Connect: onUringConnect(op, cqe); break;
+                case UringOp::Recv:    onUringRecv(op, cqe); break;
+                case UringOp::Send:    onUringSend(op, cqe); break;
+                }
+            });
+}
+
+
+void
+Endpoint::
+armAccept(UringOp* op)
+{
+    struct io_uring_sqe* sqe = uring.sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = op->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+
+    if (std::find(acceptOps.begin(), acceptOps.end(), op) == acceptOps.end())
+        acceptOps.push_back(op);
+}
+
+void
+Endpoint::
+onUringAccept(UringOp* op, const struct io_uring_cqe& cqe)
+{
+    if (cqe.res >= 0) {
+        Socket socket = Socket::adopt(cqe.res);
+        if (!op->cancelled) connect(std::move(socket));
+    }
+
+    if (cqe.flags & IORING_CQE_F_MORE) return;
+
+    if (op->cancelled || cqe.res == -ECANCELED) {
+        auto it = std::find(acceptOps.begin(), acceptOps.end(), op);
+        if (it != acceptOps.end()) acceptOps.erase(it);
+
+        freeUringOp(op);
+        return;
+    }
+
+    armAccept(op);
+}
+
+
+/** Waits for the socket to become writable which is our cue that an outgoing
+    connection went through. */
+void
+Endpoint::
+armConnect(ConnectionState& conn)
+{
+    UringOp* op = newUringOp(UringOp::Connect, conn.socket.fd(), conn.id);
+
+    struct io_uring_sqe* sqe = uring.sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = op->fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+}
+
+void
+Endpoint::
+onUringConnect(UringOp* op, const struct io_uring_cqe& cqe)
+{
+    ConnectionState* conn = findConnection(*op);
+    freeUringOp(op);
+
+    if (!conn) return;
+
+    if (!conn->connected) {
+        if (onNewConnection) onNewConnection(conn->id);
+        conn->connected = true;
+    }
+
+    int err = cqe.res < 0 ? -cqe.res : conn->socket.error();
+    if (err) {
+        if (!onError || onError(conn->id, err)) disconnect(conn->id);
+        return;
+    }
+
+    conn->writable = true;
+    armSend(*conn);
+}
+
+
+void
+Endpoint::
+armRecv(UringOp* op)
+{
+    struct io_uring_sqe* sqe = uring.sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = op->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::BufferGroup;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+}
+
+void
+Endpoint::
+onUringRecv(UringOp* op, const struct io_uring_cqe& cqe)
+{
+    int fd = op->fd;
+    ConnectionState* conn = findConnection(*op);
+    bool live = conn;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t buffer = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (live && cqe.res > 0) {
+            conn->bytesRecv += cqe.res;
+            live = recvBytes(fd, uring.buffer(buffer), cqe.res);
+        }
+
+        uring.recycle(buffer);
+    }
+
+    if (cqe.flags & IORING_CQE_F_MORE) return;
+
+    if (!live) {
+        freeUringOp(op);
+        return;
+    }
+
+    // A result of 0 indicates that shutdown was called on the client side.
+    ConnId id = op->id;
+
+    if (!cqe.res) {
+        freeUringOp(op);
+        disconnect(id);
+        return;
+    }
+
+    // Multishot receives also stop whenever we run out of provided buffers in
+    // which case we just pick up where we left off.
+    if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+        if (!onError || onError(id, -cqe.res)) {
+            freeUringOp(op);
+            disconnect(id);
+            return;
+        }
+    }
+
+    armRecv(op);
+}
+
+/** Same as recvPayload except that the bytes come from a provided buffer
+    instead of being read straight into the receive buffer.
+
+    Returns false if the connection is gone or should no longer be read from.
+ */
+bool
+Endpoint::
+recvBytes(int fd, const uint8_t* data, size_t size)
+{
+    while (size) {
+        ConnectionState* connPtr = connections.find(fd);
+        if (!connPtr) return false;
+
+        auto& conn = *connPtr;
+
+        if (conn.largeFrame) {
+            size_t left = conn.largeFrame.size() - conn.largeFrameRecv;
+            size_t n = std::min(size, left);
+
+            auto out = conn.largeFrame.begin() + conn.largeFrameRecv;
+            std::copy(data, data + n, out);
+
+            conn.largeFrameRecv += n;
+            data += n;
+            size -= n;
+
+            if (conn.largeFrameRecv < conn.largeFrame.size()) continue;
+
+            Payload frame = std::move(conn.largeFrame);
+            conn.largeFrameRecv = 0;
+            if (!dispatchFrame(conn.id, std::move(frame))) return false;
+            continue;
+        }
+
+        if (!initRecvBuffer(conn)) {
+            disconnect(conn.id);
+            return false;
+        }
+
+        auto& buffer = conn.recvBuffer;
+        if (buffer.available() < size) buffer.compact();
+
+        size_t n = std::min(size, buffer.available());
+        std::copy(data, data + n, buffer.tail());
+        buffer.commit(n);
+
+        data += n;
+        size -= n;
+
+        if (!processRecvBuffer(fd)) return false;
+    }
+
+    return true;
+}
+
+
+/** Only one send is in flight per connection at any given time; anything sent
+    in the meantime piles up in the send queue until it completes.
+ */
+void
+Endpoint::
+armSend(ConnectionState& conn)
+{
+    if (conn.sending || !conn.writable || conn.sendQueue.empty()) return;
+
+    enum { MaxIov = IOV_MAX < 1024 ? IOV_MAX : 1024 };
+
+    auto& queue = conn.sendQueue;
+    size_t n = std::min<size_t>(queue.size(), MaxIov);
+
+    UringOp* op = newUringOp(UringOp::Send, conn.socket.fd(), conn.id);
+
+    op->batch.reserve(n);
+    std::move(queue.begin(), queue.begin() + n, std::back_inserter(op->batch));
+    queue.erase(queue.begin(), queue.begin() + n);
+
+    // Entries that don't make it into the iovecs because of chains are put
+    // back in the queue along with the unwritten bytes on completion.
+    struct iovec iov[MaxIov];
+    size_t iovs = 0;
+    for (size_t i = 0; i < n && iovs < MaxIov; ++i)
+        iovs += op->batch[i].iovecs(iov + iovs, MaxIov - iovs);
+    op->iov.assign(iov, iov + iovs);
+
+    std::memset(&op->msg, 0, sizeof op->msg);
+    op->msg.msg_iov = op->iov.data();
+    op->msg.msg_iovlen = iovs;
+
+    struct io_uring_sqe* sqe = uring.sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = op->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&op->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+
+    conn.sending = true;
+    stats_.sendCalls++;
+}
+
+void
+Endpoint::
+onUringSend(UringOp* op, const struct io_uring_cqe& cqe)
+{
+    auto& batch = op->batch;
+
+    size_t done = 0;
+    size_t left = cqe.res > 0 ? cqe.res : 0;
+
+    while (left) {
+        auto& entry = batch[done];
+        size_t size = entry.size();
+
+        if (left < size) {
+            entry.offset += left;
             break;
+        }
+
+        left -= size;
+        done++;
+        stats_.sentPayloads++;
     }
 
-    if (i == queue.size()) return;
+    ConnectionState* conn = findConnection(*op);
+
+    if (!conn) {
+        for (size_t i = done; i < batch.size(); ++i)
+            dropQueued(op->id, std::move(batch[i]));
+        freeUringOp(op);
+        return;
+    }
 
-    for (; i < queue.size(); ++i)
-        dropPayload(fd, std::move(queue[i].first));
+    conn->sending = false;
+    if (cqe.res > 0) {
+        conn->bytesSent += cqe.res;
+        conn->queuedBytes -= cqe.res;
+        publishQueuedBytes(*conn);
+    }
+
+    auto& queue = conn->sendQueue;
+    queue.insert(queue.begin(),
+            std::make_move_iterator(batch.begin() + done),
+            std::make_move_iterator(batch.end()));
+    freeUringOp(op);
+
+    if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN) {
+        if (!onError || onError(conn->id, -cqe.res)) abortQueue(*conn);
+        return;
+    }
 
-    disconnect(fd);
+    armSend(*conn);
+    releaseBackpressure(*conn);
 }
 
 } // slick
@@ -12,57 +12,313 @@
 #include "notify.h"
 #include "poll.h"
 #include "payload.h"
+#include "payload_chain.h"
 #include "defer.h"
+#include "recv_buffer.h"
+#include "fd_table.h"
+#include "uring.h"
+#include "timer.h"
 #include "sorted_vector.h"
 
 #include <vector>
 #include <functional>
-#include <unordered_map>
 #include <cstdint>
+#include <cassert>
 
 namespace slick {
 
+/******************************************************************************/
+/* CONN ID                                                                    */
+/******************************************************************************/
+
+/** Handle to a connection made up of its fd in the lower 32 bits and a
+    generation in the upper 32 bits. Fds are recycled by the kernel as soon as
+    they're closed so the generation is what keeps a stale handle from
+    reaching whichever connection reused the fd. Generations are shared by
+    all the endpoints in the process so a handle can't be mistaken for one
+    handed out by another endpoint either. 0 is never a valid handle.
+ */
+typedef uint64_t ConnId;
+
+inline ConnId makeConnId(int fd, uint32_t generation)
+{
+    return (uint64_t(generation) << 32) | uint32_t(fd);
+}
+
+inline int connFd(ConnId id) { return int(uint32_t(id)); }
+
+
 /******************************************************************************/
 /* ENDPOINT PROVIDER                                                          */
 /******************************************************************************/
 
 struct Endpoint : public ThreadAwarePollable
 {
-    Endpoint();
-    Endpoint(Port listenPort);
+    /** The io_uring backend does the accepts, receives and sends through
+        completions instead of readiness notifications: accepts and receives
+        are multishot and the sends queued during a poll iteration are
+        submitted together right before going back to the kernel for more
+        events.
+     */
+    enum IoBackend { EpollBackend, UringBackend };
+
+    explicit Endpoint(IoBackend backend = EpollBackend);
+    Endpoint(Port listenPort, IoBackend backend = EpollBackend);
     virtual ~Endpoint();
 
+    /** Can differ from the requested backend if the kernel doesn't support
+        the io_uring features that we need.
+     */
+    IoBackend backend() const { return uring ? UringBackend : EpollBackend; }
+
     Endpoint(const Endpoint&) = delete;
     Endpoint& operator=(const Endpoint&) = delete;
 
-    typedef std::function<void(int fd)> ConnectionFn;
+    typedef std::function<void(ConnId conn)> ConnectionFn;
     ConnectionFn onNewConnection;
+
+    /** Called for every connection that goes away including the ones that
+        failed or were disconnected before onNewConnection was called.
+     */
     ConnectionFn onLostConnection;
 
-    typedef std::function<void(int fd, Payload&& d)> PayloadFn;
+    typedef std::function<void(ConnId conn, Payload&& d)> PayloadFn;
     PayloadFn onPayload;
     PayloadFn onDroppedPayload;
 
-    typedef std::function<bool(int fd, int errnum)> ErrorFn;
+    /** Zero-copy alternative to onPayload which, if set, takes precedence over
+        it. The range points directly into the connection's receive buffer and
+        is only valid for the duration of the callback. Use the Payload range
+        constructor to keep a copy of the frame around.
+     */
+    typedef std::function<void(
+            ConnId conn,
+            Payload::const_iterator first,
+            Payload::const_iterator last)>
+        PayloadViewFn;
+    PayloadViewFn onPayloadView;
+
+    typedef std::function<bool(ConnId conn, int errnum)> ErrorFn;
     ErrorFn onError;
 
+    /** Called with true when the send queue of a connection goes over the
+        high watermark and with false once it drains back under the low
+        watermark. Producers should hold off on sending to the connection in
+        between or risk having their payloads dropped once the queue hits its
+        hard limit.
+     */
+    typedef std::function<void(ConnId conn, bool engaged)> BackpressureFn;
+    BackpressureFn onBackpressure;
+
 
     int fd() const { return poller.fd(); }
     void poll(int timeoutMs = 0);
     void stopPolling();
 
-    void listen(Port listenPort);
+    void listen(Port listenPort, bool reusePort = false);
+
+    enum { DefaultRecvBufferSize = 1 << 16 };
+
+    /** Size of the receive buffer allocated for each connection. Only affects
+        connections that haven't received anything yet. Frames larger then the
+        buffer bypass it and are read directly into their own payload.
+     */
+    void recvBufferSize(size_t bytes = DefaultRecvBufferSize)
+    {
+        assert(bytes >= Payload::MaxHeaderSize);
+        recvBufferSize_ = bytes;
+    }
+
+    /** Carves the receive buffers out of a pre-faulted arena with room for
+        the given number of buffers of the current recvBufferSize. See
+        BufferArena for the flags. Once the arena is exhausted, Grow maps more
+        room while Drop disconnects the connections that can't get a buffer.
+
+        Must be called before any connection is added to the endpoint.
+     */
+    void recvBufferArena(
+            size_t buffers,
+            unsigned flags = 0,
+            BufferArena::Policy policy = BufferArena::Grow)
+    {
+        assert(!isPollThread.isPolling());
+        assert(connections.empty());
+
+        arena = BufferArena(recvBufferSize_, buffers, flags, policy);
+    }
+
+    /** Not synchronized with the polling thread; same as stats(). */
+    const BufferArena::Stats& recvBufferArenaStats() const
+    {
+        return arena.stats();
+    }
+
+    enum { DefaultMaxFrameSize = Payload::LargeMarker - 1 };
 
-    void send(int fd, Payload&& data);
-    void send(int fd, const Payload& data)
+    /** Largest payload that will be sent or accepted on a connection. Payloads
+        above the default use an extended header which older endpoints can't
+        parse so both sides must agree on raising the limit. Oversized sends are
+        dropped and a peer sending an oversized frame gets disconnected.
+     */
+    void maxFrameSize(size_t bytes = DefaultMaxFrameSize)
     {
-        send(fd, Payload(data));
+        maxFrameSize_ = bytes;
     }
 
-    void multicast(const SortedVector<int>& fds, Payload&& data);
-    void multicast(const SortedVector<int>& fds, const Payload& data)
+    enum {
+        DefaultLowWatermark = 1 << 18,
+        DefaultHighWatermark = 1 << 20,
+        DefaultMaxSendQueue = 1 << 26,
+    };
+
+    /** Thresholds, in bytes of unsent data, at which onBackpressure is
+        triggered for a connection.
+     */
+    void sendQueueWatermarks(
+            size_t low = DefaultLowWatermark, size_t high = DefaultHighWatermark)
+    {
+        assert(low < high);
+        lowWatermark = low;
+        highWatermark = high;
+    }
+
+    /** Payloads that would push the send queue of a connection over this many
+        bytes are dropped. An empty queue always accepts a payload so that
+        frames larger than the limit can still make it through.
+     */
+    void maxSendQueue(size_t bytes = DefaultMaxSendQueue)
+    {
+        maxSendQueue_ = bytes;
+    }
+
+    /** Bytes queued on the connection that have yet to be written to the
+        socket. Can be called from any thread but is only a snapshot when
+        called outside of the polling thread since the queue keeps changing
+        underneath it. Returns 0 for stale handles.
+     */
+    size_t pendingBytes(ConnId conn) const;
+
+    /** When corked, payloads sent from the polling thread are queued instead
+        of being written right away. The queues are then written out with a
+        single vectored write per connection at the end of the call to poll or
+        whenever enough payloads pile up on a connection.
+     */
+    void cork(bool enable = true) { cork_ = enable; }
+
+    enum { DefaultCoalesceSize = 1 << 12 };
+
+    /** Frames of up to maxFrame bytes, header included, are copied into a
+        per-connection buffer of bufferSize bytes instead of being sent on
+        their own. The buffer is written out as soon as it can't be guaranteed
+        to hold another frame, before any larger payload is sent on the
+        connection and at the end of the call to poll.
+
+        If deadlineUs is set then the buffer is instead allowed to linger
+        across calls to poll for up to deadlineUs microseconds which trades
+        latency for fewer writes when the payloads trickle in.
+
+        Frames are laid out exactly as they would've been on the wire so the
+        other end can't tell the difference. A maxFrame of 0 turns it off.
+     */
+    void coalesce(
+            size_t maxFrame,
+            size_t bufferSize = DefaultCoalesceSize,
+            size_t deadlineUs = 0)
+    {
+        assert(!isPollThread.isPolling());
+        assert(maxFrame <= bufferSize);
+
+        coalesceMaxFrame = maxFrame;
+        coalesceSize_ = bufferSize;
+        coalesceDeadlineUs = deadlineUs;
+    }
+
+    enum { DefaultZeroCopyThreshold = 1 << 16 };
+
+    /** Payloads of at least threshold bytes are sent with MSG_ZEROCOPY which
+        has the kernel send straight out of the payload instead of copying it
+        into the socket buffer. The payloads are kept alive until the kernel
+        signals through the error queue of the socket that it's done with them.
+
+        Only applies to connections added afterwards and is ignored by the
+        io_uring backend and by kernels that don't support SO_ZEROCOPY. Sends
+        fall back on regular copies whenever the kernel can't pin any more
+        pages for the socket. A threshold of 0 turns it off.
+
+        Chains are always copied because their header lives within the chain
+        itself which can move while the kernel holds on to it. The threshold
+        must also be large enough to rule out inline payloads for the same
+        reason.
+
+        Closing a connection doesn't release the payloads that the kernel is
+        still holding on to. The socket is instead kept open until all their
+        completions are reaped. Only destroying the endpoint releases them
+        early.
+     */
+    void zeroCopy(size_t threshold = DefaultZeroCopyThreshold)
     {
-        multicast(fds, Payload(data));
+        assert(!isPollThread.isPolling());
+        assert(!threshold || threshold > sizeof(Payload));
+        zeroCopyThreshold = threshold;
+    }
+
+    /** Makes poll spin on a non-blocking epoll_wait for up to budgetUs before
+        falling back on a blocking wait. The polling thread should call poll
+        directly in a loop instead of going through a SourcePoller or the
+        extra epoll hop will block anyway.
+
+        If socketBusyPoll is set then SO_BUSY_POLL is also set on all new
+        connections with the same budget. Going above the net.core.busy_read
+        sysctl requires CAP_NET_ADMIN and the option is silently skipped if we
+        don't have it.
+     */
+    void busyPoll(size_t budgetUs, bool socketBusyPoll = false)
+    {
+        busyPollUs = budgetUs;
+        socketBusyPoll_ = socketBusyPoll;
+    }
+
+    struct Stats
+    {
+        Stats() :
+            sendCalls(0), sentPayloads(0), coalescedPayloads(0),
+            zeroCopySends(0), zeroCopyCopied(0), zeroCopyFallbacks(0),
+            emptySpins(0), productiveSpins(0)
+        {}
+
+        size_t sendCalls;
+        size_t sentPayloads; // A coalesced buffer counts as one payload.
+        size_t coalescedPayloads;
+
+        // Send calls issued with MSG_ZEROCOPY, how many of them the kernel
+        // ended up copying anyway (always the case over loopback) and how
+        // many had to be retried as regular sends.
+        size_t zeroCopySends;
+        size_t zeroCopyCopied;
+        size_t zeroCopyFallbacks;
+
+        // Non-blocking epoll_wait calls issued while busy polling that
+        // respectively came back empty or with events.
+        size_t emptySpins;
+        size_t productiveSpins;
+    };
+
+    /** Not synchronized with the polling thread so reading it from another
+        thread will only yield an approximation.
+     */
+    const Stats& stats() const { return stats_; }
+
+    /** Sends to a stale handle are dropped. */
+    void send(ConnId conn, Payload&& data);
+    void send(ConnId conn, const Payload& data)
+    {
+        send(conn, Payload(data));
+    }
+
+    void multicast(const SortedVector<ConnId>& conns, Payload&& data);
+    void multicast(const SortedVector<ConnId>& conns, const Payload& data)
+    {
+        multicast(conns, Payload(data));
     }
 
     void broadcast(Payload&& data);
@@ -71,49 +327,181 @@ struct Endpoint : public ThreadAwarePollable
         broadcast(Payload(data));
     }
 
+    /** Chains are written with a single vectored write straight out of their
+        fragments which are never copied into a contiguous payload unless the
+        chain is coalesced or dropped. Dropped chains are flattened before
+        being handed to onDroppedPayload.
+     */
+    void send(ConnId conn, PayloadChain&& data);
+    void send(ConnId conn, const PayloadChain& data)
+    {
+        send(conn, PayloadChain(data));
+    }
+
+    void multicast(const SortedVector<ConnId>& conns, PayloadChain&& data);
+    void multicast(const SortedVector<ConnId>& conns, const PayloadChain& data)
+    {
+        multicast(conns, PayloadChain(data));
+    }
+
+    void broadcast(PayloadChain&& data);
+    void broadcast(const PayloadChain& data)
+    {
+        broadcast(PayloadChain(data));
+    }
 
-    void connect(Socket&& socket);
-    int connect(const Address& addr);
-    int connect(const NodeAddress& node);
 
-    void disconnect(int fd);
+    /** The handle is valid as soon as these return, even if the connection
+        is only added to the endpoint later on by the polling thread.
+     */
+    ConnId connect(Socket&& socket);
+    ConnId connect(const Address& addr);
+    ConnId connect(const NodeAddress& node);
+
+    void disconnect(ConnId conn);
 
 
 private:
 
     struct Operation;
+    struct QueuedPayload;
+    // A vector because, unlike a deque, it doesn't allocate until the first
+    // zero copy send which keeps the connection slabs allocation-free.
+    typedef std::vector< std::pair<uint32_t, QueuedPayload> > ZeroCopyPending;
+
+    /** Copy of a connection's queuedBytes which pendingBytes() can read from
+        any thread. Tagged with the id of the connection so that stale handles
+        can be weeded out.
+     */
+    struct SharedQueuedBytes
+    {
+        std::atomic<ConnId> id;
+        std::atomic<size_t> bytes;
+    };
+    struct LingeringSocket;
     struct ConnectionState;
+    struct UringOp;
 
-    void init();
+    void init(IoBackend backend);
 
+    ConnectionState* find(ConnId id);
+    const ConnectionState* find(ConnId id) const;
+    void doConnect(Socket&& socket, ConnId id);
+
+    bool wait(int timeoutMs);
     void accept(int fd);
 
     void recvPayload(int fd);
-    uint8_t* processRecvBuffer(uint8_t*, uint8_t*, std::vector<Payload>&);
+    bool initRecvBuffer(ConnectionState& conn);
+    bool processRecvBuffer(int fd);
+    bool dispatchFrame(ConnId id, const uint8_t* first, const uint8_t* last);
+    bool dispatchFrame(ConnId id, Payload&& data);
+
+    template<typename Data> void sendNow(ConnId id, Data&& data);
+    template<typename Data>
+    void multicastNow(const SortedVector<ConnId>& ids, const Data& data);
+    template<typename Data> void broadcastNow(const Data& data);
 
-    template<typename Payload>
-    void pushToSendQueue(ConnectionState& conn, Payload&& data, size_t offset);
+    void pushToSendQueue(ConnectionState& conn, QueuedPayload&& entry);
 
-    template<typename Payload>
-    bool sendTo(ConnectionState& conn, Payload&& data, size_t offset = 0);
+    template<typename Data>
+    bool sendTo(ConnectionState& conn, Data&& data);
 
-    template<typename Payload>
-    void dropPayload(int h, Payload&& payload) const;
+    template<typename Data>
+    void dropPayload(ConnId id, Data&& payload) const;
+    void dropQueued(ConnId id, QueuedPayload&& entry) const;
 
     void flushQueue(int fd);
+    void writeOut(ConnectionState& conn);
+    bool writeQueue(ConnectionState& conn);
+    void abortQueue(ConnectionState& conn);
+    void releaseBackpressure(ConnectionState& conn);
+    void publishQueuedBytes(ConnectionState& conn);
+    void markCorked(ConnectionState& conn);
+    void flushCorked();
+    template<typename Data>
+    bool appendCoalesced(ConnectionState& conn, const Data& data);
+    bool isZeroCopy(const ConnectionState& conn, size_t size) const;
+    bool isZeroCopy(const ConnectionState& conn, const QueuedPayload& entry) const;
+    void holdZeroCopy(ConnectionState& conn, QueuedPayload&& entry);
+    void reapZeroCopy(int fd, ZeroCopyPending& pending);
+    void reapLingering(int fd, LingeringSocket& sock);
+    void flushCoalesced(ConnectionState& conn);
+    void flushCoalesced();
+    QueuedPayload takeCoalesced(ConnectionState& conn);
     void onOperation(Operation&& op);
 
     void doDisconnect(std::vector<int> fd);
     void doDisconnect(int fd);
 
+    void initUring();
+    void closeUring();
+    UringOp* newUringOp(int type, int fd, ConnId id = 0);
+    void freeUringOp(UringOp* op);
+    void armAccept(UringOp* op);
+    void armConnect(ConnectionState& conn);
+    void armRecv(UringOp* op);
+    void armSend(ConnectionState& conn);
+    void submitUring();
+    void reapUring();
+    void onUringAccept(UringOp* op, const struct io_uring_cqe& cqe);
+    void onUringConnect(UringOp* op, const struct io_uring_cqe& cqe);
+    void onUringRecv(UringOp* op, const struct io_uring_cqe& cqe);
+    void onUringSend(UringOp* op, const struct io_uring_cqe& cqe);
+    ConnectionState* findConnection(const UringOp& op);
+    bool recvBytes(int fd, const uint8_t* data, size_t size);
+
 
     Epoll poller;
 
+    /** Entry in the send queue of a connection where offset is the number of
+        bytes of the packet that were already written. The bytes of a
+        coalesced payload are made up of complete frames and its packet header
+        is never written. Chains are queued as is and data is left empty.
+     */
+    struct QueuedPayload
+    {
+        QueuedPayload(Payload data, size_t offset, bool coalesced = false) :
+            data(std::move(data)), offset(offset), coalesced(coalesced)
+        {}
+
+        QueuedPayload(PayloadChain chain, size_t offset) :
+            chain(std::move(chain)), offset(offset), coalesced(false)
+        {}
+
+        Payload data;
+        PayloadChain chain;
+        size_t offset;
+        bool coalesced;
+
+        const uint8_t* first() const { return data.packet() + offset; }
+
+        size_t size() const
+        {
+            return (data ? data.packetSize() : chain.packetSize()) - offset;
+        }
+
+        /** Fills up to n iovecs with the unwritten bytes of the entry. */
+        size_t iovecs(struct iovec* iov, size_t n) const
+        {
+            if (!data) return chain.iovecs(offset, iov, n);
+            if (!n) return 0;
+
+            iov->iov_base = const_cast<uint8_t*>(first());
+            iov->iov_len = size();
+            return 1;
+        }
+    };
+
     struct ConnectionState
     {
         ConnectionState() :
-            bytesSent(0), bytesRecv(0),
-            connected(false), disconnected(false), writable(false)
+            id(0), bytesSent(0), bytesRecv(0),
+            connected(false), disconnected(false), writable(false),
+            corked(false), queuedBytes(0), sharedQueuedBytes(nullptr),
+            backpressure(false),
+            coalescedBytes(0), largeFrameRecv(0), sending(false),
+            zeroCopy(false), zeroCopySeq(0)
         {}
 
         ConnectionState(ConnectionState&&) = default;
@@ -123,6 +511,7 @@ private:
         ConnectionState& operator=(const ConnectionState&) = delete;
 
         Socket socket;
+        ConnId id;
 
         size_t bytesSent;
         size_t bytesRecv;
@@ -130,10 +519,78 @@ private:
         bool connected;
         bool disconnected;
         bool writable;
-        std::vector<std::pair<Payload, size_t> > sendQueue;
+        bool corked;
+        std::vector<QueuedPayload> sendQueue;
+
+        // Unsent bytes in the send queue, including those currently being
+        // sent through io_uring.
+        size_t queuedBytes;
+        SharedQueuedBytes* sharedQueuedBytes;
+        bool backpressure;
+
+        // Small frames waiting to be written as a single payload.
+        Payload coalesceBuffer;
+        size_t coalescedBytes;
+
+        RecvBuffer recvBuffer;
+
+        // Frame too large for recvBuffer which is being read in place.
+        Payload largeFrame;
+        size_t largeFrameRecv;
+
+        // io_uring send in flight.
+        bool sending;
+
+        // Payloads handed to the kernel with MSG_ZEROCOPY along with the
+        // sequence number of their send call, in the order they were sent.
+        bool zeroCopy;
+        uint32_t zeroCopySeq;
+        ZeroCopyPending zeroCopyPending;
+    };
+
+    /** Socket of a closed connection whose zero copy sends are still held by
+        the kernel. It stays open and registered with the poller until the last
+        of its completions is reaped.
+     */
+    struct LingeringSocket
+    {
+        Socket socket;
+        ZeroCopyPending zeroCopyPending;
     };
 
-    std::unordered_map<int, ConnectionState> connections;
+    // Must outlive the receive buffers of the connections.
+    BufferArena arena;
+
+    FdTable<ConnectionState> connections;
+    SharedFdTable<SharedQueuedBytes> sharedQueuedBytes;
+    size_t recvBufferSize_;
+    size_t maxFrameSize_;
+    size_t lowWatermark;
+    size_t highWatermark;
+    size_t maxSendQueue_;
+
+    bool cork_;
+    bool inPoll;
+    size_t busyPollUs;
+    bool socketBusyPoll_;
+    std::vector<int> corkQueue;
+    Notify corkQueueFd;
+
+    size_t zeroCopyThreshold;
+    FdTable<LingeringSocket> lingering;
+
+    size_t coalesceMaxFrame;
+    size_t coalesceSize_;
+    size_t coalesceDeadlineUs;
+    bool coalesceTimerArmed;
+    std::vector<int> coalesceQueue;
+    Timer coalesceTimer;
+
+    Stats stats_;
+
+    Uring uring;
+    size_t uringOps;
+    std::vector<UringOp*> acceptOps;
 
     PassiveSockets listenSockets;
 
@@ -143,13 +600,16 @@ private:
     Notify disconnectQueueFd;
 
     enum { SendSize = 1 << 6 };
-    Defer<SendSize, int, Payload> sends;
-    Defer<SendSize, SortedVector<int>, Payload> multicasts;
+    ThreadLocalDefer<SendSize, ConnId, Payload> sends;
+    Defer<SendSize, SortedVector<ConnId>, Payload> multicasts;
     Defer<SendSize, Payload> broadcasts;
+    ThreadLocalDefer<SendSize, ConnId, PayloadChain> chainSends;
+    Defer<SendSize, SortedVector<ConnId>, PayloadChain> chainMulticasts;
+    Defer<SendSize, PayloadChain> chainBroadcasts;
 
     enum { ConnectSize = 1 << 4 };
-    Defer<ConnectSize, Socket> connects;
-    Defer<ConnectSize, int> disconnects;
+    Defer<ConnectSize, Socket, ConnId> connects;
+    Defer<ConnectSize, ConnId> disconnects;
 
     enum { DeferCap = 1 << 6 };
 };
@@ -162,20 +622,20 @@ private:
 struct Connection
 {
     Connection(Endpoint& endpoint, const Address& addr) :
-        endpoint(endpoint), fd(endpoint.connect(addr))
+        endpoint(endpoint), id(endpoint.connect(addr))
     {}
 
     Connection(Endpoint& endpoint, const NodeAddress& node) :
-        endpoint(endpoint), fd(endpoint.connect(node))
+        endpoint(endpoint), id(endpoint.connect(node))
     {}
 
-    ~Connection() { endpoint.disconnect(fd); }
+    ~Connection() { endpoint.disconnect(id); }
 
-    operator bool() const { return !fd; }
+    operator bool() const { return !id; }
 
 private:
     Endpoint& endpoint;
-    int fd;
+    ConnId id;
 };
 
 
@@ -0,0 +1,315 @@
+/* endpoint_group.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 16 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Endpoint group implementation.
+*/
+
+#include "endpoint_group.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <sys/resource.h>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* ENDPOINT GROUP                                                             */
+/******************************************************************************/
+
+EndpointGroup::
+EndpointGroup(size_t shards) :
+    isDone(true), nextShard(0)
+{
+    init(shards);
+}
+
+EndpointGroup::
+EndpointGroup(size_t shards, Port listenPort) :
+    isDone(true), nextShard(0)
+{
+    init(shards);
+
+    for (auto& shard : this->shards)
+        shard->listen(listenPort, true);
+}
+
+EndpointGroup::
+~EndpointGroup()
+{
+    join();
+
+    // Shards call back into the group when they close their connections so
+    // they must go before anything else.
+    shards.clear();
+}
+
+void
+EndpointGroup::
+init(size_t numShards)
+{
+    assert(numShards);
+
+    enum { MinFds = 1 << 10, MaxFds = 1 << 22 };
+
+    struct rlimit limit;
+    int ret = getrlimit(RLIMIT_NOFILE, &limit);
+    SLICK_CHECK_ERRNO(!ret, "EndpointGroup.getrlimit");
+
+    ownersSize = std::max<size_t>(MinFds, std::min<size_t>(MaxFds, limit.rlim_cur));
+    owners.reset(new std::atomic<uint32_t>[ownersSize]);
+    for (size_t i = 0; i < ownersSize; ++i) owners[i] = 0;
+
+    for (size_t i = 0; i < numShards; ++i) {
+        shards.emplace_back(new Endpoint());
+        Endpoint& shard = *shards.back();
+
+        shard.onNewConnection = [=] (ConnId id) {
+            if (!setOwner(connFd(id), i)) {
+                shards[i]->disconnect(id);
+                return;
+            }
+            if (onNewConnection) onNewConnection(id);
+        };
+
+        // Also triggered for connections that died before being announced
+        // which is the only chance to clear the entry set in connect().
+        shard.onLostConnection = [=] (ConnId id) {
+            clearOwner(connFd(id), i);
+            if (onLostConnection) onLostConnection(id);
+        };
+
+        shard.onPayload = [=] (ConnId id, Payload&& data) {
+            if (onPayload) onPayload(id, std::move(data));
+        };
+
+        shard.onDroppedPayload = [=] (ConnId id, Payload&& data) {
+            if (onDroppedPayload) onDroppedPayload(id, std::move(data));
+        };
+
+        shard.onBackpressure = [=] (ConnId id, bool engaged) {
+            if (onBackpressure) onBackpressure(id, engaged);
+        };
+    }
+}
+
+bool
+EndpointGroup::
+setOwner(int fd, size_t shard)
+{
+    if (size_t(fd) >= ownersSize) return false;
+
+    owners[fd].store(shard + 1, std::memory_order_release);
+    return true;
+}
+
+/** A closed fd can be reused by another shard before the lost connection
+    callback of the previous owner is triggered so we can only clear the entry
+    if it still belongs to the shard.
+ */
+bool
+EndpointGroup::
+clearOwner(int fd, size_t shard)
+{
+    if (size_t(fd) >= ownersSize) return false;
+
+    uint32_t expected = shard + 1;
+    return owners[fd].compare_exchange_strong(expected, 0);
+}
+
+/** Stale handles are routed like any other and it's up to the shard to weed
+    them out.
+ */
+int
+EndpointGroup::
+owner(ConnId id) const
+{
+    int fd = connFd(id);
+    if (fd < 0 || size_t(fd) >= ownersSize) return -1;
+    return int(owners[fd].load(std::memory_order_acquire)) - 1;
+}
+
+
+void
+EndpointGroup::
+run()
+{
+    // The view callback is installed lazily because its mere presence changes
+    // how the shards dispatch their payloads.
+    for (auto& shard : shards) {
+        if (!onPayloadView) continue;
+
+        shard->onPayloadView = [=] (
+                ConnId id,
+                Payload::const_iterator first,
+                Payload::const_iterator last)
+            {
+                onPayloadView(id, first, last);
+            };
+    }
+
+    isDone = false;
+
+    for (auto& shard : shards) {
+        Endpoint* pShard = shard.get();
+
+        threads.emplace_back([=] {
+                    pShard->startPolling();
+                    while (!isDone) pShard->poll(100);
+                    pShard->stopPolling();
+                });
+    }
+}
+
+void
+EndpointGroup::
+join()
+{
+    if (isDone) return;
+    isDone = true;
+
+    for (auto& th : threads) th.join();
+    threads.clear();
+}
+
+
+namespace {
+
+Payload toPayload(Payload&& data) { return std::move(data); }
+Payload toPayload(const Payload& data) { return data; }
+Payload toPayload(const PayloadChain& chain) { return chain.flatten(); }
+
+} // namespace anonymous
+
+template<typename Data>
+void
+EndpointGroup::
+sendImpl(ConnId id, Data&& data)
+{
+    int shard = owner(id);
+
+    if (shard < 0) {
+        if (onDroppedPayload) onDroppedPayload(id, toPayload(std::move(data)));
+        return;
+    }
+
+    shards[shard]->send(id, std::move(data));
+}
+
+template<typename Data>
+void
+EndpointGroup::
+multicastImpl(const SortedVector<ConnId>& ids, Data&& data)
+{
+    std::vector< std::vector<ConnId> > split(shards.size());
+
+    for (ConnId id : ids) {
+        int shard = owner(id);
+
+        if (shard >= 0) split[shard].push_back(id);
+        else if (onDroppedPayload) onDroppedPayload(id, toPayload(data));
+    }
+
+    for (size_t i = 0; i < split.size(); ++i) {
+        if (split[i].empty()) continue;
+
+        SortedVector<ConnId> shardIds(split[i].begin(), split[i].end());
+        shards[i]->multicast(shardIds, data);
+    }
+}
+
+template<typename Data>
+void
+EndpointGroup::
+broadcastImpl(Data&& data)
+{
+    for (auto& shard : shards)
+        shard->broadcast(data);
+}
+
+
+void
+EndpointGroup::
+send(ConnId id, Payload&& data)
+{
+    sendImpl(id, std::move(data));
+}
+
+void
+EndpointGroup::
+multicast(const SortedVector<ConnId>& ids, Payload&& data)
+{
+    multicastImpl(ids, std::move(data));
+}
+
+void
+EndpointGroup::
+broadcast(Payload&& data)
+{
+    broadcastImpl(std::move(data));
+}
+
+void
+EndpointGroup::
+send(ConnId id, PayloadChain&& data)
+{
+    sendImpl(id, std::move(data));
+}
+
+void
+EndpointGroup::
+multicast(const SortedVector<ConnId>& ids, PayloadChain&& data)
+{
+    multicastImpl(ids, std::move(data));
+}
+
+void
+EndpointGroup::
+broadcast(PayloadChain&& data)
+{
+    broadcastImpl(std::move(data));
+}
+
+
+ConnId
+EndpointGroup::
+connect(const Address& addr)
+{
+    return connect(Socket::connect(addr));
+}
+
+ConnId
+EndpointGroup::
+connect(const NodeAddress& node)
+{
+    return connect(Socket::connect(node));
+}
+
+ConnId
+EndpointGroup::
+connect(Socket&& socket)
+{
+    if (!socket) return 0;
+
+    size_t shard = nextShard.fetch_add(1) % shards.size();
+
+    // The owner must be known before the shard gets a chance to use the
+    // connection.
+    int fd = socket.fd();
+    if (!setOwner(fd, shard)) return 0;
+
+    ConnId id = shards[shard]->connect(std::move(socket));
+    if (!id) clearOwner(fd, shard);
+    return id;
+}
+
+void
+EndpointGroup::
+disconnect(ConnId id)
+{
+    int shard = owner(id);
+    if (shard >= 0) shards[shard]->disconnect(id);
+}
+
+} // slick
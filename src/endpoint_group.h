@@ -0,0 +1,135 @@
+/* endpoint_group.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 16 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Group of endpoints polled by independent threads.
+*/
+
+#pragma once
+
+#include "endpoint.h"
+
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* ENDPOINT GROUP                                                             */
+/******************************************************************************/
+
+/** Spreads connections over multiple endpoints (shards) which are each polled
+    by their own thread. Each shard has its own connections and its own defer
+    queues so the shards never contend with each other.
+
+    When listening, every shard binds the port with SO_REUSEPORT which lets the
+    kernel balance the incoming connections. Outgoing connections are handed
+    out to the shards in a round-robin fashion.
+
+    The send functions can be called from any thread and are routed to the
+    shard that owns the connection. The callbacks are invoked from the polling
+    thread of the shard which owns the connection which means that they can be
+    called concurrently.
+ */
+struct EndpointGroup
+{
+    explicit EndpointGroup(size_t shards);
+    EndpointGroup(size_t shards, Port listenPort);
+    ~EndpointGroup();
+
+    EndpointGroup(const EndpointGroup&) = delete;
+    EndpointGroup& operator=(const EndpointGroup&) = delete;
+
+    Endpoint::ConnectionFn onNewConnection;
+    Endpoint::ConnectionFn onLostConnection;
+
+    Endpoint::PayloadFn onPayload;
+    Endpoint::PayloadFn onDroppedPayload;
+
+    /** Same as Endpoint::onPayloadView; takes precedence over onPayload. */
+    Endpoint::PayloadViewFn onPayloadView;
+
+    Endpoint::BackpressureFn onBackpressure;
+
+    size_t size() const { return shards.size(); }
+
+    /** Meant for tweaking the configuration of the shards before calling run.
+        Shard callbacks are used by the group and must not be overwritten.
+     */
+    Endpoint& shard(size_t index) { return *shards[index]; }
+
+    void run();
+    void join();
+
+    void send(ConnId conn, Payload&& data);
+    void send(ConnId conn, const Payload& data)
+    {
+        send(conn, Payload(data));
+    }
+
+    void multicast(const SortedVector<ConnId>& conns, Payload&& data);
+    void multicast(const SortedVector<ConnId>& conns, const Payload& data)
+    {
+        multicast(conns, Payload(data));
+    }
+
+    void broadcast(Payload&& data);
+    void broadcast(const Payload& data)
+    {
+        broadcast(Payload(data));
+    }
+
+    void send(ConnId conn, PayloadChain&& data);
+    void send(ConnId conn, const PayloadChain& data)
+    {
+        send(conn, PayloadChain(data));
+    }
+
+    void multicast(const SortedVector<ConnId>& conns, PayloadChain&& data);
+    void multicast(const SortedVector<ConnId>& conns, const PayloadChain& data)
+    {
+        multicast(conns, PayloadChain(data));
+    }
+
+    void broadcast(PayloadChain&& data);
+    void broadcast(const PayloadChain& data)
+    {
+        broadcast(PayloadChain(data));
+    }
+
+    ConnId connect(const Address& addr);
+    ConnId connect(const NodeAddress& node);
+
+    void disconnect(ConnId conn);
+
+private:
+
+    void init(size_t shards);
+
+    template<typename Data> void sendImpl(ConnId conn, Data&& data);
+    template<typename Data>
+    void multicastImpl(const SortedVector<ConnId>& conns, Data&& data);
+    template<typename Data> void broadcastImpl(Data&& data);
+
+    ConnId connect(Socket&& socket);
+
+    bool setOwner(int fd, size_t shard);
+    bool clearOwner(int fd, size_t shard);
+    int owner(ConnId id) const;
+
+    std::vector< std::unique_ptr<Endpoint> > shards;
+    std::vector<std::thread> threads;
+    std::atomic<bool> isDone;
+
+    std::atomic<size_t> nextShard;
+
+    // Indexed by fd and holds the index of the owning shard plus one so that a
+    // zeroed entry means that the fd isn't owned by any shard.
+    std::unique_ptr< std::atomic<uint32_t>[] > owners;
+    size_t ownersSize;
+};
+
+} // slick
@@ -0,0 +1,195 @@
+/* fd_table.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 19 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Table of values indexed by file descriptors.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* FD TABLE                                                                   */
+/******************************************************************************/
+
+/** Map from fd to T which takes advantage of the kernel always handing out
+    the lowest available fd. Values live in an fd-indexed slab which makes
+    lookups a couple of array accesses while the live entries are also tracked
+    in a packed array which can be scanned linearly.
+
+    The slab is allocated in fixed size chunks so values never move once
+    inserted: references remain valid until the value is erased regardless of
+    what else is inserted in the meantime.
+ */
+template<typename T>
+struct FdTable
+{
+    struct Entry
+    {
+        int fd;
+        T* value;
+    };
+
+    typedef typename std::vector<Entry>::const_iterator const_iterator;
+
+    FdTable() {}
+
+    FdTable(const FdTable&) = delete;
+    FdTable& operator=(const FdTable&) = delete;
+
+    size_t size() const { return live.size(); }
+    bool empty() const { return live.empty(); }
+
+    /** Iterates over the live entries in no particular order. Inserting or
+        erasing invalidates the iterators but not the values.
+     */
+    const_iterator begin() const { return live.begin(); }
+    const_iterator end() const { return live.end(); }
+
+    /** Same as begin()[i] which, unlike iterators, survives insertions. */
+    const Entry& operator[] (size_t i) const { return live[i]; }
+
+    bool count(int fd) const { return find(fd); }
+
+    T* find(int fd)
+    {
+        Slot* entry = slot(fd);
+        return entry && entry->index != Dead ? &entry->value : nullptr;
+    }
+
+    const T* find(int fd) const
+    {
+        return const_cast<FdTable*>(this)->find(fd);
+    }
+
+    T& insert(int fd, T&& value)
+    {
+        assert(fd >= 0);
+
+        size_t chunk = size_t(fd) / ChunkSize;
+        while (chunks.size() <= chunk)
+            chunks.emplace_back(new Slot[ChunkSize]);
+
+        Slot& entry = *slot(fd);
+        assert(entry.index == Dead);
+
+        entry.value = std::move(value);
+        entry.index = live.size();
+
+        live.push_back(Entry{ fd, &entry.value });
+        return entry.value;
+    }
+
+    /** The value is reset to a default constructed value to release whatever
+        resources it was holding.
+     */
+    void erase(int fd)
+    {
+        Slot* entry = slot(fd);
+        assert(entry && entry->index != Dead);
+
+        size_t index = entry->index;
+        if (index != live.size() - 1) {
+            live[index] = live.back();
+            slot(live[index].fd)->index = index;
+        }
+        live.pop_back();
+
+        entry->index = Dead;
+        entry->value = T();
+    }
+
+private:
+
+    enum { ChunkSize = 1 << 8 };
+    enum : uint32_t { Dead = uint32_t(-1) };
+
+    struct Slot
+    {
+        Slot() : index(Dead) {}
+
+        T value;
+        uint32_t index;
+    };
+
+    Slot* slot(int fd)
+    {
+        if (fd < 0) return nullptr;
+
+        size_t chunk = size_t(fd) / ChunkSize;
+        if (chunk >= chunks.size()) return nullptr;
+
+        return &chunks[chunk][size_t(fd) % ChunkSize];
+    }
+
+    std::vector< std::unique_ptr<Slot[]> > chunks;
+    std::vector<Entry> live;
+};
+
+
+/******************************************************************************/
+/* SHARED FD TABLE                                                            */
+/******************************************************************************/
+
+/** Fd-indexed slab of T which can be looked up from any thread while a single
+    thread, the only one allowed to call slot(), allocates it.
+
+    The chunks are published through a fixed size directory and are only freed
+    along with the table so a slot remains valid once found. Slots are value
+    initialized and it's up to T (usually a bunch of atomics) to make its own
+    content safe to access concurrently. Fds past MaxFds have no slot.
+ */
+template<typename T>
+struct SharedFdTable
+{
+    enum { ChunkSize = 1 << 10, MaxChunks = 1 << 12 };
+    enum { MaxFds = ChunkSize * MaxChunks };
+
+    SharedFdTable()
+    {
+        for (auto& chunk : chunks) chunk.store(nullptr);
+    }
+
+    ~SharedFdTable()
+    {
+        for (auto& chunk : chunks) delete[] chunk.load();
+    }
+
+    SharedFdTable(const SharedFdTable&) = delete;
+    SharedFdTable& operator=(const SharedFdTable&) = delete;
+
+    /** Can be called from any thread. */
+    T* find(int fd) const
+    {
+        if (fd < 0 || size_t(fd) >= MaxFds) return nullptr;
+
+        T* chunk = chunks[size_t(fd) / ChunkSize].load(std::memory_order_acquire);
+        return chunk ? &chunk[size_t(fd) % ChunkSize] : nullptr;
+    }
+
+    /** Allocates the slot if needed. Returns nullptr if fd is out of range. */
+    T* slot(int fd)
+    {
+        if (fd < 0 || size_t(fd) >= MaxFds) return nullptr;
+
+        auto& chunk = chunks[size_t(fd) / ChunkSize];
+        if (!chunk.load(std::memory_order_relaxed))
+            chunk.store(new T[ChunkSize](), std::memory_order_release);
+
+        return find(fd);
+    }
+
+private:
+    std::array<std::atomic<T*>, MaxChunks> chunks;
+};
+
+} // slick
@@ -114,24 +114,24 @@ onWatch(const std::string& key,
     const auto& watch = activeWatches[handle];
     if (watch.filter && !watch.filter(filterData)) return;
 
-    int fd = Endpoint::connect(node);
-    assert(fd > 0);
-    connections[fd] = Connection(key, keyId);
+    ConnId id = Endpoint::connect(node);
+    assert(id);
+    connections[id] = Connection(key, keyId);
 }
 
 
 void
 NamedEndpoint::
-onDisconnect(int fd)
+onDisconnect(ConnId id)
 {
     assert(isPollThread());
 
-    auto it = connections.find(fd);
+    auto it = connections.find(id);
     assert(it != connections.end());
 
     discovery.lost(it->second.key, it->second.keyId);
 
-    if (onLostConnection) onLostConnection(fd);
+    if (onLostConnection) onLostConnection(id);
 }
 
 } // slick
@@ -48,7 +48,7 @@ struct NamedEndpoint : public Endpoint
 
 private:
 
-    void onDisconnect(int fd);
+    void onDisconnect(ConnId id);
     void onWatch(
             const std::string& key,
             Discovery::WatchHandle handle,
@@ -85,7 +85,7 @@ private:
             key(std::move(key)), keyId(std::move(keyId))
         {}
     };
-    std::unordered_map<int, Connection> connections;
+    std::unordered_map<ConnId, Connection> connections;
 
     enum { QueueSize = 1 << 4 };
     Defer<QueueSize, std::string, FilterFn> connects;
@@ -20,7 +20,7 @@ namespace slick {
 /******************************************************************************/
 
 Notify::
-Notify()
+Notify() : armed(false)
 {
     fd_ = eventfd(0, EFD_NONBLOCK);
     SLICK_CHECK_ERRNO(fd_ >= 0, "Notify.eventfd");
@@ -37,6 +37,8 @@ bool
 Notify::
 poll()
 {
+    armed.store(false);
+
     eventfd_t val;
     while (true) {
         ssize_t ret = read(fd_, &val, sizeof val);
@@ -55,6 +57,8 @@ void
 Notify::
 signal()
 {
+    if (armed.exchange(true)) return;
+
     eventfd_t val = 1;
     int ret = eventfd_write(fd_, val);
     SLICK_CHECK_ERRNO(!ret, "Notify.write");
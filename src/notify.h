@@ -7,12 +7,18 @@
 
 #pragma once
 
+#include <atomic>
+
 namespace slick {
 
 /******************************************************************************/
 /* NOTIFY                                                                     */
 /******************************************************************************/
 
+/** Only the first signal after a call to poll issues a write on the fd which
+    means that the consumer must call poll before looking for work or it
+    could miss the signal of work that it didn't see.
+ */
 struct Notify
 {
     Notify();
@@ -28,6 +34,7 @@ struct Notify
 
 private:
     int fd_;
+    std::atomic<bool> armed;
 };
 
 } // slick
@@ -11,17 +11,28 @@
 #pragma once
 
 #include "payload.h"
+#include "payload_chain.h"
 #include "utils.h"
 
+#include <tuple>
 #include <memory>
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <utility>
 #include <type_traits>
 #include <cassert>
 #include <cstring>
 #include <endian.h> // linux specific
 
+#if defined(__SSSE3__)
+#  include <tmmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#endif
+
 
 namespace slick {
 
@@ -40,6 +51,7 @@ struct IsSizedNumber
 };
 
 template<size_t N> struct SizedInt;
+template<> struct SizedInt<2> { typedef uint16_t type; };
 template<> struct SizedInt<4> { typedef uint32_t type; };
 template<> struct SizedInt<8> { typedef uint64_t type; };
 
@@ -124,32 +136,246 @@ T ntoh(T val, typename std::enable_if< std::is_floating_point<T>::value >::type*
 
 
 
+/******************************************************************************/
+/* BULK ENDIAN                                                                */
+/******************************************************************************/
+
+namespace details {
+
+#if defined(__SSSE3__)
+
+template<size_t Size> __m128i bswapMask();
+
+template<> inline __m128i bswapMask<2>()
+{
+    return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+}
+
+template<> inline __m128i bswapMask<4>()
+{
+    return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+}
+
+template<> inline __m128i bswapMask<8>()
+{
+    return _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+}
+
+#endif // __SSSE3__
+
+
+/** Copies n elements of Size bytes while swapping the bytes of each element.
+    The shuffles are only used if the target supports them which requires
+    building with the appropriate -m flags (see USE_NATIVE_ARCH).
+ */
+template<size_t Size>
+void bswapCopy(const uint8_t* src, uint8_t* dest, size_t n)
+{
+    typedef typename SizedInt<Size>::type Int;
+
+    size_t i = 0;
+    const size_t bytes = n * Size;
+
+#if defined(__AVX2__)
+    // The shuffle operates on each 128 bits lane independently.
+    __m128i lane = bswapMask<Size>();
+    __m256i mask256 = _mm256_inserti128_si256(_mm256_castsi128_si256(lane), lane, 1);
+
+    for (; i + 32 <= bytes; i += 32) {
+        auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        value = _mm256_shuffle_epi8(value, mask256);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), value);
+    }
+#endif
+
+#if defined(__SSSE3__)
+    __m128i mask = bswapMask<Size>();
+
+    for (; i + 16 <= bytes; i += 16) {
+        auto value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        value = _mm_shuffle_epi8(value, mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), value);
+    }
+#endif
+
+    for (; i < bytes; i += Size) {
+        Int value;
+        std::memcpy(&value, src + i, Size);
+        value = hton(value);
+        std::memcpy(dest + i, &value, Size);
+    }
+}
+
+template<>
+inline void bswapCopy<1>(const uint8_t* src, uint8_t* dest, size_t n)
+{
+    std::memcpy(dest, src, n);
+}
+
+template<typename T>
+struct IsBulkNumber
+{
+    // vector<bool> has no contiguous storage and long double has no hton.
+    static constexpr bool value =
+        std::is_arithmetic<T>::value &&
+        !std::is_same<T, bool>::value &&
+        (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+};
+
+} // namespace details
+
+
+/** Converts n numbers between the host and the network representation. Since
+    the conversion is symmetric, the same function is used in both directions.
+    Single byte numbers and big-endian hosts don't need any swapping and are
+    reduced to a plain copy.
+ */
+template<typename T>
+void bulkSwap(const uint8_t* src, uint8_t* dest, size_t n,
+        typename std::enable_if< details::IsBulkNumber<T>::value >::type* = 0)
+{
+    if (__BYTE_ORDER == __BIG_ENDIAN)
+        std::memcpy(dest, src, n * sizeof(T));
+
+    else details::bswapCopy<sizeof(T)>(src, dest, n);
+}
+
+
 /******************************************************************************/
 /* TYPEDEFS                                                                   */
 /******************************************************************************/
 
+/** Specializations of Pack provide the following interface:
+
+        static size_t size(const T& value);
+        static void pack(const T& value, PackIt first, PackIt last);
+        static ConstPackIt unpack(T& value, ConstPackIt first, ConstPackIt last);
+
+    where unpack returns the end of the bytes it consumed so that the next
+    field can be unpacked without having to recompute the size of the value.
+
+    The older form which returns the value is still supported:
+
+        static T unpack(ConstPackIt first, ConstPackIt last);
+
+    but finding the end of the value then requires a second pass over it to
+    compute its packed size.
+
+    Types which always pack to the same number of bytes can also declare:
+
+        enum { FixedSize = N };
+
+    which allows packAll and unpackAll to lay out a sequence of such values at
+    offsets known at compile time.
+ */
 template<typename T, typename Enable = void> struct Pack;
 
 typedef Payload::iterator PackIt;
 typedef Payload::const_iterator ConstPackIt;
 
 
+/******************************************************************************/
+/* FIXED SIZE                                                                 */
+/******************************************************************************/
+
+namespace details {
+
+template<typename T> struct Void { typedef void type; };
+
+/** Packed size of T if it's known at compile time and 0 otherwise. */
+template<typename T, typename Enable = void>
+struct FixedSize
+{
+    static constexpr size_t value = 0;
+};
+
+template<typename T>
+struct FixedSize<T, typename Void<decltype(Pack<T>::FixedSize)>::type>
+{
+    static constexpr size_t value = Pack<T>::FixedSize;
+};
+
+
+/** Sum of the packed sizes of Args if they're all known at compile time and 0
+    otherwise.
+ */
+template<typename... Args> struct FixedSizeAll;
+
+template<>
+struct FixedSizeAll<>
+{
+    static constexpr size_t value = 0;
+};
+
+template<typename Arg>
+struct FixedSizeAll<Arg>
+{
+    static constexpr size_t value =
+        FixedSize<typename std::decay<Arg>::type>::value;
+};
+
+template<typename Arg, typename... Rest>
+struct FixedSizeAll<Arg, Rest...>
+{
+    static constexpr size_t head = FixedSizeAll<Arg>::value;
+    static constexpr size_t tail = FixedSizeAll<Rest...>::value;
+    static constexpr size_t value = head && tail ? head + tail : 0;
+};
+
+template<typename... Args>
+struct IsFixedSize :
+        public std::integral_constant<bool, FixedSizeAll<Args...>::value != 0>
+{};
+
+} // namespace details
+
+
 /******************************************************************************/
 /* PACKED SIZE                                                                */
 /******************************************************************************/
 
+namespace details {
+
 template<typename T>
-size_t packedSize(const T& value)
+size_t packedSize(const T&, std::true_type)
+{
+    return FixedSize<T>::value;
+}
+
+template<typename T>
+size_t packedSize(const T& value, std::false_type)
 {
     return Pack<T>::size(value);
 }
 
-inline size_t packedSizeAll() { return 0; }
+template<typename... Args>
+size_t packedSizeAll(std::true_type, const Args&...)
+{
+    return FixedSizeAll<Args...>::value;
+}
+
+inline size_t packedSizeAll(std::false_type) { return 0; }
 
 template<typename Arg, typename... Rest>
-size_t packedSizeAll(const Arg& arg, const Rest&... rest)
+size_t packedSizeAll(std::false_type, const Arg& arg, const Rest&... rest)
+{
+    return details::packedSize(arg, IsFixedSize<Arg>()) +
+        details::packedSizeAll(IsFixedSize<Rest...>(), rest...);
+}
+
+} // namespace details
+
+
+template<typename T>
+size_t packedSize(const T& value)
+{
+    return details::packedSize(value, details::IsFixedSize<T>());
+}
+
+template<typename... Args>
+size_t packedSizeAll(const Args&... args)
 {
-    return packedSize(arg) + packedSizeAll(rest...);
+    return details::packedSizeAll(details::IsFixedSize<Args...>(), args...);
 }
 
 
@@ -173,13 +399,49 @@ Payload pack(const T& value)
 }
 
 
-inline PackIt packAll(PackIt first, PackIt) { return first; }
+namespace details {
+
+template<size_t Offset>
+void packFixed(PackIt, PackIt) {}
+
+template<size_t Offset, typename Arg, typename... Rest>
+void packFixed(PackIt first, PackIt last, const Arg& arg, const Rest&... rest)
+{
+    Pack<Arg>::pack(arg, first + Offset, last);
+    details::packFixed<Offset + FixedSize<Arg>::value>(first, last, rest...);
+}
+
+template<typename... Args>
+PackIt packAll(std::true_type, PackIt first, PackIt last, const Args&... args)
+{
+    assert(size_t(last - first) >= FixedSizeAll<Args...>::value);
+
+    details::packFixed<0>(first, last, args...);
+    return first + FixedSizeAll<Args...>::value;
+}
+
+inline PackIt packAll(std::false_type, PackIt first, PackIt) { return first; }
 
 template<typename Arg, typename... Rest>
-PackIt packAll(PackIt first, PackIt last, const Arg& arg, const Rest&... rest)
+PackIt packAll(
+        std::false_type, PackIt first, PackIt last,
+        const Arg& arg, const Rest&... rest)
 {
-    auto it = pack(arg, first, last);
-    return packAll(it, last, rest...);
+    auto it = slick::pack(arg, first, last);
+    return details::packAll(IsFixedSize<Rest...>(), it, last, rest...);
+}
+
+} // namespace details
+
+
+/** When all the arguments have a fixed size they're stored at offsets known at
+    compile time instead of threading the iterator through each of them.
+ */
+template<typename... Args>
+PackIt packAll(PackIt first, PackIt last, const Args&... args)
+{
+    return details::packAll(
+            details::IsFixedSize<Args...>(), first, last, args...);
 }
 
 template<typename... Args>
@@ -191,12 +453,118 @@ Payload packAll(const Args&... args)
 }
 
 
+/******************************************************************************/
+/* PACK CHAIN                                                                 */
+/******************************************************************************/
+
+inline size_t chainedSize() { return 0; }
+
+template<typename Arg, typename... Rest>
+size_t chainedSize(const Arg& arg, const Rest&... rest)
+{
+    return packedSize(arg) + chainedSize(rest...);
+}
+
+template<typename... Rest>
+size_t chainedSize(const Payload&, const Rest&... rest)
+{
+    return chainedSize(rest...);
+}
+
+
+/** Adds the bytes of head packed since run to the chain. */
+inline void packChain(
+        PayloadChain& chain, const Payload& head, PackIt run, PackIt it)
+{
+    chain.append(head, run - head.packet(), it - run);
+}
+
+template<typename Arg, typename... Rest>
+void packChain(
+        PayloadChain& chain, Payload& head, PackIt run, PackIt it,
+        const Arg& arg, const Rest&... rest)
+{
+    it = pack(arg, it, head.end());
+    packChain(chain, head, run, it, rest...);
+}
+
+template<typename... Rest>
+void packChain(
+        PayloadChain& chain, Payload& head, PackIt run, PackIt it,
+        const Payload& arg, const Rest&... rest)
+{
+    packChain(chain, head, run, it);
+    chain.appendPacket(arg);
+    packChain(chain, head, it, it, rest...);
+}
+
+/** Same frame as packAll except that the payloads in the arguments are
+    referenced by the chain instead of being copied. Everything else is packed
+    into a single payload shared by the fragments in between.
+ */
+template<typename... Args>
+PayloadChain packChain(const Args&... args)
+{
+    PayloadChain chain;
+
+    Payload head(chainedSize(args...));
+    packChain(chain, head, head.begin(), head.begin(), args...);
+
+    return chain;
+}
+
+
 /******************************************************************************/
 /* UNPACK                                                                     */
 /******************************************************************************/
 
+namespace details {
+
 template<typename T>
-T unpack(ConstPackIt first, ConstPackIt last)
+struct IsUnpackInPlace
+{
+    template<typename U>
+    static auto test(int) -> decltype(
+            Pack<U>::unpack(std::declval<U&>(), ConstPackIt(), ConstPackIt()),
+            std::true_type());
+
+    template<typename U>
+    static std::false_type test(...);
+
+    static constexpr bool value = decltype(test<T>(0))::value;
+};
+
+} // namespace details
+
+
+template<typename T>
+typename std::enable_if<details::IsUnpackInPlace<T>::value, ConstPackIt>::type
+unpack(T& value, ConstPackIt first, ConstPackIt last)
+{
+    return Pack<T>::unpack(value, first, last);
+}
+
+template<typename T>
+typename std::enable_if<!details::IsUnpackInPlace<T>::value, ConstPackIt>::type
+unpack(T& value, ConstPackIt first, ConstPackIt last)
+{
+    value = Pack<T>::unpack(first, last);
+    return first + packedSize(value);
+}
+
+
+template<typename T>
+typename std::enable_if<details::IsUnpackInPlace<T>::value, T>::type
+unpack(ConstPackIt first, ConstPackIt last)
+{
+    T value;
+    Pack<T>::unpack(value, first, last);
+    return value;
+}
+
+template<typename T>
+typename std::enable_if<!details::IsUnpackInPlace<T>::value, T>::type
+unpack(ConstPackIt first, ConstPackIt last)
 {
     return Pack<T>::unpack(first, last);
 }
@@ -213,21 +581,50 @@ void unpack(const Payload& data, T& value)
     unpack(value, data.cbegin(), data.cend());
 }
 
-template<typename T>
-ConstPackIt unpack(T& value, ConstPackIt first, ConstPackIt last)
+namespace details {
+
+template<size_t Offset>
+void unpackFixed(ConstPackIt, ConstPackIt) {}
+
+template<size_t Offset, typename Arg, typename... Rest>
+void unpackFixed(ConstPackIt first, ConstPackIt last, Arg& arg, Rest&... rest)
 {
-    value = Pack<T>::unpack(first, last);
-    return first + packedSize(value);
+    slick::unpack(arg, first + Offset, last);
+    details::unpackFixed<Offset + FixedSize<Arg>::value>(first, last, rest...);
 }
 
+template<typename... Args>
+ConstPackIt unpackAll(
+        std::true_type, ConstPackIt first, ConstPackIt last, Args&... args)
+{
+    assert(size_t(last - first) >= FixedSizeAll<Args...>::value);
 
-inline ConstPackIt unpackAll(ConstPackIt first, ConstPackIt) { return first; }
+    details::unpackFixed<0>(first, last, args...);
+    return first + FixedSizeAll<Args...>::value;
+}
+
+inline ConstPackIt unpackAll(std::false_type, ConstPackIt first, ConstPackIt)
+{
+    return first;
+}
 
 template<typename Arg, typename... Rest>
-ConstPackIt unpackAll(ConstPackIt first, ConstPackIt last, Arg& arg, Rest&... rest)
+ConstPackIt unpackAll(
+        std::false_type, ConstPackIt first, ConstPackIt last,
+        Arg& arg, Rest&... rest)
 {
-    auto it = unpack(arg, first, last);
-    return unpackAll(it, last, rest...);
+    auto it = slick::unpack(arg, first, last);
+    return details::unpackAll(IsFixedSize<Rest...>(), it, last, rest...);
+}
+
+} // namespace details
+
+
+template<typename... Args>
+ConstPackIt unpackAll(ConstPackIt first, ConstPackIt last, Args&... args)
+{
+    return details::unpackAll(
+            details::IsFixedSize<Args...>(), first, last, args...);
 }
 
 template<typename... Args>
@@ -244,6 +641,8 @@ void unpackAll(const Payload& value, Args&... args)
 template<typename T>
 struct Pack<T, typename std::enable_if< std::is_arithmetic<T>::value >::type>
 {
+    enum { FixedSize = sizeof(T) };
+
     static constexpr size_t size(T) { return sizeof(T); }
 
     static void pack(T value, PackIt first, PackIt last)
@@ -252,10 +651,11 @@ struct Pack<T, typename std::enable_if< std::is_arithmetic<T>::value >::type>
         *reinterpret_cast<T*>(first) = hton(value);
     }
 
-    static T unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(T& value, ConstPackIt first, ConstPackIt last)
     {
         assert(size_t(last - first) >= sizeof(T));
-        return ntoh(*reinterpret_cast<const T*>(first));
+        value = ntoh(*reinterpret_cast<const T*>(first));
+        return first + sizeof(T);
     }
 
 };
@@ -278,11 +678,13 @@ struct Pack<std::string>
         *(first + value.size()) = '\0';
     }
 
-    static std::string unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(
+            std::string& value, ConstPackIt first, ConstPackIt last)
     {
         auto it = std::find(first, last, '\0');
         assert(it != last);
-        return std::string(reinterpret_cast<const char*>(first), it - first);
+        value.assign(reinterpret_cast<const char*>(first), it - first);
+        return it + 1;
     }
 };
 
@@ -335,6 +737,8 @@ struct Pack< std::pair<T1, T2> >
 {
     typedef std::pair<T1, T2> PairT;
 
+    enum { FixedSize = details::FixedSizeAll<T1, T2>::value };
+
     static size_t size(const PairT& value)
     {
         return packedSizeAll(value.first, value.second);
@@ -345,11 +749,9 @@ struct Pack< std::pair<T1, T2> >
         packAll(first, last, value.first, value.second);
     }
 
-    static PairT unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(PairT& value, ConstPackIt first, ConstPackIt last)
     {
-        PairT value;
-        unpackAll(first, last, value.first, value.second);
-        return std::move(value);
+        return unpackAll(first, last, value.first, value.second);
     }
 };
 
@@ -363,6 +765,8 @@ struct Pack< std::tuple<Args...> >
 {
     typedef std::tuple<Args...> TupleT;
 
+    enum { FixedSize = details::FixedSizeAll<Args...>::value };
+
     template<size_t... S>
     static size_t size(const TupleT& value, Seq<S...>)
     {
@@ -388,16 +792,15 @@ struct Pack< std::tuple<Args...> >
 
 
     template<size_t... S>
-    static void unpack(TupleT& value, ConstPackIt first, ConstPackIt last, Seq<S...>)
+    static ConstPackIt unpack(
+            TupleT& value, ConstPackIt first, ConstPackIt last, Seq<S...>)
     {
-        unpackAll(first, last, std::get<S>(value)...);
+        return unpackAll(first, last, std::get<S>(value)...);
     }
 
-    static TupleT unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(TupleT& value, ConstPackIt first, ConstPackIt last)
     {
-        TupleT value;
-        unpack(value, first, last, typename GenSeq<sizeof...(Args)>::type());
-        return std::move(value);
+        return unpack(value, first, last, typename GenSeq<sizeof...(Args)>::type());
     }
 };
 
@@ -407,35 +810,36 @@ struct Pack< std::tuple<Args...> >
 /******************************************************************************/
 
 template<typename T>
-struct Pack< std::vector<T> >
+struct Pack< std::vector<T>,
+             typename std::enable_if< !details::IsBulkNumber<T>::value >::type >
 {
     static size_t size(const std::vector<T>& value)
     {
         // Note: gcc optimizes out this loop for simple types.
-        size_t size = sizeof(Payload::SizeT);
+        size_t size = Payload::headerSize(value.size());
         for (const auto& item: value) size += packedSize(item);
         return size;
     }
 
     static void pack(const std::vector<T>& value, PackIt first, PackIt last)
     {
-        *reinterpret_cast<Payload::SizeT*>(first) = value.size();
-
-        PackIt it = first + sizeof(Payload::SizeT);
+        PackIt it = Payload::writeHeader(first, value.size());
         for (const auto& item : value) {
             it = slick::pack(item, it, last);
             assert(it <= last);
         }
     }
 
-    static std::vector<T> unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(
+            std::vector<T>& value, ConstPackIt first, ConstPackIt last)
     {
-        size_t size = *reinterpret_cast<const Payload::SizeT*>(first);
+        size_t size;
+        ConstPackIt it = Payload::readHeader(first, last, size);
+        assert(it);
 
-        std::vector<T> value;
+        value.clear();
         value.reserve(size);
 
-        ConstPackIt it = first + sizeof(Payload::SizeT);
         for (size_t i = 0; i < size; ++i) {
             T item;
             it = slick::unpack(item, it, last);
@@ -444,12 +848,48 @@ struct Pack< std::vector<T> >
             value.emplace_back(std::move(item));
         }
 
-        return std::move(value);
+        return it;
     }
 
 };
 
 
+/** Vectors of numbers are converted in bulk instead of one element at a time
+    and the destination vector is sized once when unpacking.
+ */
+template<typename T>
+struct Pack< std::vector<T>,
+             typename std::enable_if< details::IsBulkNumber<T>::value >::type >
+{
+    static size_t size(const std::vector<T>& value)
+    {
+        return Payload::headerSize(value.size()) + value.size() * sizeof(T);
+    }
+
+    static void pack(const std::vector<T>& value, PackIt first, PackIt last)
+    {
+        PackIt it = Payload::writeHeader(first, value.size());
+        assert(size_t(last - it) >= value.size() * sizeof(T));
+
+        bulkSwap<T>(
+                reinterpret_cast<const uint8_t*>(value.data()), it, value.size());
+    }
+
+    static ConstPackIt unpack(
+            std::vector<T>& value, ConstPackIt first, ConstPackIt last)
+    {
+        size_t size;
+        ConstPackIt it = Payload::readHeader(first, last, size);
+        assert(it && size_t(last - it) >= size * sizeof(T));
+
+        value.resize(size);
+        bulkSwap<T>(it, reinterpret_cast<uint8_t*>(value.data()), size);
+
+        return it + size * sizeof(T);
+    }
+};
+
+
 /******************************************************************************/
 /* PAYLOAD                                                                    */
 /******************************************************************************/
@@ -464,21 +904,159 @@ struct Pack<Payload>
 
     static void pack(const Payload& value, PackIt first, PackIt last)
     {
+        // The packet is already framed the way we want it.
         assert(first + value.packetSize() <= last);
-        *reinterpret_cast<Payload::SizeT*>(first) = value.size();
-        std::copy(value.cbegin(), value.cend(), first + sizeof(Payload::SizeT));
+        std::copy(value.packet(), value.packet() + value.packetSize(), first);
+    }
+
+    static ConstPackIt unpack(Payload& value, ConstPackIt first, ConstPackIt last)
+    {
+        size_t size;
+        ConstPackIt it = Payload::readHeader(first, last, size);
+        assert(it && it + size <= last);
+
+        value = Payload(it, it + size);
+        return it + size;
+    }
+};
+
+
+/******************************************************************************/
+/* STRUCT                                                                     */
+/******************************************************************************/
+
+/** Lists the fields of a struct to pack; see SLICK_PACK_STRUCT. */
+template<typename T, typename Enable = void> struct PackFields {};
+
+namespace details {
+
+template<typename T>
+struct IsPackStruct
+{
+    template<typename U>
+    static auto test(int) -> decltype(
+            PackFields<U>::tie(std::declval<U&>()), std::true_type());
+
+    template<typename U>
+    static std::false_type test(...);
+
+    static constexpr bool value = decltype(test<T>(0))::value;
+};
+
+template<typename Tuple> struct DecayTuple;
+
+template<typename... Args>
+struct DecayTuple< std::tuple<Args...> >
+{
+    typedef std::tuple<typename std::decay<Args>::type...> type;
+};
+
+} // namespace details
+
+
+/** Packs the fields of the struct one after the other as if they were part of
+    a tuple. Structs whose fields all have a fixed size also have a fixed size.
+ */
+template<typename T>
+struct Pack<T, typename std::enable_if< details::IsPackStruct<T>::value >::type>
+{
+    typedef decltype(PackFields<T>::tie(std::declval<T&>())) TieT;
+    typedef typename details::DecayTuple<TieT>::type TupleT;
+    typedef typename GenSeq<std::tuple_size<TieT>::value>::type SeqT;
+
+    enum { FixedSize = details::FixedSize<TupleT>::value };
+
+    template<typename Fields, size_t... S>
+    static size_t size(const Fields& fields, Seq<S...>)
+    {
+        return packedSizeAll(std::get<S>(fields)...);
     }
 
-    static Payload unpack(ConstPackIt first, ConstPackIt last)
+    static size_t size(const T& value)
     {
-        Payload value(*reinterpret_cast<const Payload::SizeT*>(first));
+        return size(PackFields<T>::tie(value), SeqT());
+    }
 
-        auto it = first + sizeof(Payload::SizeT);
-        assert(it + value.size() <= last);
 
-        std::copy(it, it + value.size(), value.begin());
-        return std::move(value);
+    template<typename Fields, size_t... S>
+    static void pack(const Fields& fields, PackIt first, PackIt last, Seq<S...>)
+    {
+        packAll(first, last, std::get<S>(fields)...);
+    }
+
+    static void pack(const T& value, PackIt first, PackIt last)
+    {
+        pack(PackFields<T>::tie(value), first, last, SeqT());
+    }
+
+
+    template<typename Fields, size_t... S>
+    static ConstPackIt unpack(
+            Fields fields, ConstPackIt first, ConstPackIt last, Seq<S...>)
+    {
+        return unpackAll(first, last, std::get<S>(fields)...);
+    }
+
+    static ConstPackIt unpack(T& value, ConstPackIt first, ConstPackIt last)
+    {
+        return unpack(PackFields<T>::tie(value), first, last, SeqT());
     }
 };
 
+
+#define SLICK_PACK_CAT_(_a_,_b_) _a_ ## _b_
+#define SLICK_PACK_CAT(_a_,_b_) SLICK_PACK_CAT_(_a_,_b_)
+
+#define SLICK_PACK_NARGS(...)                                           \
+    SLICK_PACK_NARGS_(__VA_ARGS__,                                      \
+            16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+#define SLICK_PACK_NARGS_(                                              \
+        _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+        _n_, ...)                                                       \
+    _n_
+
+#define SLICK_PACK_FIELDS_1(_v_,_f_) _v_._f_
+#define SLICK_PACK_FIELDS_2(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_1(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_3(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_2(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_4(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_3(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_5(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_4(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_6(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_5(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_7(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_6(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_8(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_7(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_9(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_8(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_10(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_9(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_11(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_10(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_12(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_11(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_13(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_12(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_14(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_13(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_15(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_14(_v_,__VA_ARGS__)
+#define SLICK_PACK_FIELDS_16(_v_,_f_,...) _v_._f_, SLICK_PACK_FIELDS_15(_v_,__VA_ARGS__)
+
+#define SLICK_PACK_FIELDS(_v_,...)                                      \
+    SLICK_PACK_CAT(SLICK_PACK_FIELDS_, SLICK_PACK_NARGS(__VA_ARGS__))(_v_,__VA_ARGS__)
+
+
+/** Makes a struct packable by listing its public fields in the order in which
+    they should be packed (up to 16). Must be used in the global namespace:
+
+        struct Header { uint16_t type; uint32_t version; uint64_t count; };
+        SLICK_PACK_STRUCT(Header, type, version, count)
+
+    The struct must be default constructible to be unpacked.
+ */
+#define SLICK_PACK_STRUCT(_type_,...)                                   \
+    namespace slick {                                                   \
+    template<>                                                          \
+    struct PackFields<_type_>                                           \
+    {                                                                   \
+        template<typename T>                                            \
+        static auto tie(T& value)                                       \
+            -> decltype(std::tie(SLICK_PACK_FIELDS(value,__VA_ARGS__))) \
+        {                                                               \
+            return std::tie(SLICK_PACK_FIELDS(value,__VA_ARGS__));      \
+        }                                                               \
+    };                                                                  \
+    }
+
 } // slick
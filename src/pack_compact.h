@@ -0,0 +1,311 @@
+/* pack_compact.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 25 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Compact encoding for integers and container lengths.
+
+   Wrapping a value in Compact changes how it's laid out on the wire:
+
+   - integers are packed as LEB128 varints (7 bits per byte, least significant
+     group first) and signed integers are zigzag encoded beforehand so that
+     small negative values also stay small;
+
+   - vectors and payloads have their length packed as a varint instead of a
+     Payload header.
+
+   Small counters, TTLs and lengths then take one or two bytes instead of their
+   full width. It's opt-in since both ends have to agree on which fields are
+   compact:
+
+       packAll(Msg::Keys, compact(ttl), compact(items));
+
+       Compact<size_t> ttl;
+       Compact< std::vector<KeyItem> > items;
+       unpackAll(data, type, ttl, items);
+*/
+
+#pragma once
+
+#include "pack.h"
+
+#include <vector>
+#include <cstring>
+#include <limits>
+#include <cassert>
+#include <type_traits>
+#include <endian.h> // linux specific
+
+namespace slick {
+
+
+/******************************************************************************/
+/* VARINT                                                                     */
+/******************************************************************************/
+
+namespace details {
+
+inline size_t varintSize(uint64_t value)
+{
+    // Number of significant bits rounded up to a multiple of 7.
+    size_t bits = 64 - __builtin_clzll(value | 1);
+    return (bits + 6) / 7;
+}
+
+inline uint8_t* writeVarint(uint8_t* it, uint64_t value)
+{
+    while (value >= 0x80) {
+        *it++ = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+
+    *it++ = uint8_t(value);
+    return it;
+}
+
+/** Byte at a time decoder used for values that don't fit in the fast path.
+    Returns nullptr if the varint is truncated or malformed.
+ */
+inline const uint8_t* readVarintSlow(
+        const uint8_t* it, const uint8_t* last, uint64_t& value)
+{
+    value = 0;
+
+    for (size_t shift = 0; it != last && shift < 64; shift += 7) {
+        uint8_t byte = *it++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return it;
+    }
+
+    return nullptr;
+}
+
+/** Decodes the varint at it and returns an iterator to the byte following it
+    or nullptr if the varint is truncated or malformed.
+
+    Varints of up to 8 bytes (56 bits) that are followed by enough bytes to
+    load a full word are decoded without looping over the bytes: the length is
+    found through the first byte whose continuation bit is clear and the 7 bit
+    groups are then squeezed together with a few shifts and masks.
+ */
+inline const uint8_t* readVarint(
+        const uint8_t* it, const uint8_t* last, uint64_t& value)
+{
+    if (size_t(last - it) < sizeof(uint64_t))
+        return readVarintSlow(it, last, value);
+
+    uint64_t word;
+    std::memcpy(&word, it, sizeof(word));
+    word = le64toh(word);
+
+    uint64_t stops = ~word & 0x8080808080808080ULL;
+    if (!stops) return readVarintSlow(it, last, value);
+
+    size_t bytes = (__builtin_ctzll(stops) + 1) / 8;
+    if (bytes < sizeof(uint64_t))
+        word &= (uint64_t(1) << (bytes * 8)) - 1;
+
+    word &= 0x7F7F7F7F7F7F7F7FULL;
+    word = (word & 0x007F007F007F007FULL) | ((word & 0x7F007F007F007F00ULL) >> 1);
+    word = (word & 0x00003FFF00003FFFULL) | ((word & 0x3FFF00003FFF0000ULL) >> 2);
+    word = (word & 0x000000000FFFFFFFULL) | ((word & 0x0FFFFFFF00000000ULL) >> 4);
+
+    value = word;
+    return it + bytes;
+}
+
+
+template<typename T>
+uint64_t zigzag(T value, typename std::enable_if< std::is_signed<T>::value >::type* = 0)
+{
+    int64_t v = value;
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+template<typename T>
+uint64_t zigzag(T value, typename std::enable_if< std::is_unsigned<T>::value >::type* = 0)
+{
+    return value;
+}
+
+template<typename T>
+T unzigzag(uint64_t value, typename std::enable_if< std::is_signed<T>::value >::type* = 0)
+{
+    int64_t v = int64_t(value >> 1) ^ -int64_t(value & 1);
+    assert(v >= int64_t(std::numeric_limits<T>::min()));
+    assert(v <= int64_t(std::numeric_limits<T>::max()));
+    return T(v);
+}
+
+template<typename T>
+T unzigzag(uint64_t value, typename std::enable_if< std::is_unsigned<T>::value >::type* = 0)
+{
+    assert(value <= uint64_t(std::numeric_limits<T>::max()));
+    return T(value);
+}
+
+} // namespace details
+
+
+/******************************************************************************/
+/* PACK COMPACT                                                               */
+/******************************************************************************/
+
+namespace details {
+
+/** Same interface as Pack but for the compact encoding of T. */
+template<typename T, typename Enable = void> struct PackCompact;
+
+
+template<typename T>
+struct PackCompact<T, typename std::enable_if< std::is_integral<T>::value >::type>
+{
+    static size_t size(T value)
+    {
+        return varintSize(zigzag(value));
+    }
+
+    static void pack(T value, PackIt first, PackIt last)
+    {
+        assert(size_t(last - first) >= size(value));
+        writeVarint(first, zigzag(value));
+    }
+
+    static ConstPackIt unpack(T& value, ConstPackIt first, ConstPackIt last)
+    {
+        uint64_t raw;
+        ConstPackIt it = readVarint(first, last, raw);
+        assert(it);
+
+        value = unzigzag<T>(raw);
+        return it;
+    }
+};
+
+
+template<typename T>
+struct PackCompact< std::vector<T> >
+{
+    static size_t size(const std::vector<T>& value)
+    {
+        size_t size = varintSize(value.size());
+        for (const auto& item : value) size += slick::packedSize(item);
+        return size;
+    }
+
+    static void pack(const std::vector<T>& value, PackIt first, PackIt last)
+    {
+        PackIt it = writeVarint(first, value.size());
+        for (const auto& item : value) {
+            it = slick::pack(item, it, last);
+            assert(it <= last);
+        }
+    }
+
+    static ConstPackIt unpack(
+            std::vector<T>& value, ConstPackIt first, ConstPackIt last)
+    {
+        uint64_t size;
+        ConstPackIt it = readVarint(first, last, size);
+        assert(it);
+
+        value.clear();
+        value.reserve(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            T item;
+            it = slick::unpack(item, it, last);
+            assert(it <= last);
+
+            value.emplace_back(std::move(item));
+        }
+
+        return it;
+    }
+};
+
+
+template<>
+struct PackCompact<Payload>
+{
+    static size_t size(const Payload& value)
+    {
+        size_t size = value ? value.size() : 0;
+        return varintSize(size) + size;
+    }
+
+    static void pack(const Payload& value, PackIt first, PackIt last)
+    {
+        assert(size_t(last - first) >= size(value));
+
+        PackIt it = writeVarint(first, value ? value.size() : 0);
+        if (value) std::copy(value.cbegin(), value.cend(), it);
+    }
+
+    static ConstPackIt unpack(Payload& value, ConstPackIt first, ConstPackIt last)
+    {
+        uint64_t size;
+        ConstPackIt it = readVarint(first, last, size);
+        assert(it && size <= size_t(last - it));
+
+        value = Payload(it, it + size);
+        return it + size;
+    }
+};
+
+} // namespace details
+
+
+/******************************************************************************/
+/* COMPACT                                                                    */
+/******************************************************************************/
+
+/** Wraps a value to select its compact encoding. Only integers, vectors and
+    payloads have one.
+
+    T can be a const reference which is what compact() returns to avoid
+    copying the value when packing it.
+ */
+template<typename T>
+struct Compact
+{
+    Compact() : value() {}
+    Compact(T value) : value(std::move(value)) {}
+
+    operator const T&() const { return value; }
+
+    T value;
+};
+
+/** Meant to be used within a pack call since the returned object references
+    the value.
+ */
+template<typename T>
+Compact<const T&> compact(const T& value)
+{
+    return Compact<const T&>(value);
+}
+
+
+template<typename T>
+struct Pack< Compact<T> >
+{
+    typedef details::PackCompact<typename std::decay<T>::type> Impl;
+
+    static size_t size(const Compact<T>& value)
+    {
+        return Impl::size(value.value);
+    }
+
+    static void pack(const Compact<T>& value, PackIt first, PackIt last)
+    {
+        Impl::pack(value.value, first, last);
+    }
+
+    static ConstPackIt unpack(
+            Compact<T>& value, ConstPackIt first, ConstPackIt last)
+    {
+        return Impl::unpack(value.value, first, last);
+    }
+};
+
+} // slick
@@ -0,0 +1,328 @@
+/* pack_view.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 24 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Non-owning views over packed values.
+
+   The views can be unpacked in place of their owning counterparts to scan or
+   filter a message without copying or allocating anything:
+
+       StringView key;
+       PackedVectorView<StringView> keys;
+       unpackAll(data, key, keys);
+
+   They point directly within the packed bytes and are therefore only valid as
+   long as the payload they were unpacked from is alive. Packing a view copies
+   the bytes it points to as-is which makes it possible to forward part of a
+   message without unpacking it.
+*/
+
+#pragma once
+
+#include "pack.h"
+
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <ostream>
+#include <iterator>
+#include <algorithm>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* STRING VIEW                                                                */
+/******************************************************************************/
+
+struct StringView
+{
+    StringView() : data_(nullptr), size_(0) {}
+    StringView(const char* data, size_t size) : data_(data), size_(size) {}
+    StringView(const std::string& str) : data_(str.data()), size_(str.size()) {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+    char operator[] (size_t i) const
+    {
+        assert(i < size_);
+        return data_[i];
+    }
+
+    std::string str() const { return std::string(data_, size_); }
+
+    bool operator== (StringView other) const
+    {
+        return size_ == other.size_ && !std::memcmp(data_, other.data_, size_);
+    }
+
+    bool operator!= (StringView other) const { return !operator==(other); }
+
+    bool operator< (StringView other) const
+    {
+        int cmp = std::memcmp(data_, other.data_, std::min(size_, other.size_));
+        return cmp ? cmp < 0 : size_ < other.size_;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+inline std::ostream& operator<<(std::ostream& stream, StringView value)
+{
+    stream.write(value.data(), value.size());
+    return stream;
+}
+
+
+template<>
+struct Pack<StringView>
+{
+    static size_t size(StringView value) { return value.size() + 1; }
+
+    static void pack(StringView value, PackIt first, PackIt last)
+    {
+        assert(size_t(last - first) >= size(value));
+
+        std::copy(value.begin(), value.end(), first);
+        *(first + value.size()) = '\0';
+    }
+
+    static ConstPackIt unpack(StringView& value, ConstPackIt first, ConstPackIt last)
+    {
+        auto it = std::find(first, last, '\0');
+        assert(it != last);
+
+        value = StringView(reinterpret_cast<const char*>(first), it - first);
+        return it + 1;
+    }
+};
+
+
+/******************************************************************************/
+/* PAYLOAD VIEW                                                               */
+/******************************************************************************/
+
+/** Payload nested within another payload. */
+struct PayloadView
+{
+    typedef Payload::const_iterator const_iterator;
+
+    PayloadView() : packet_(nullptr), first_(nullptr), last_(nullptr) {}
+    PayloadView(const_iterator packet, const_iterator first, const_iterator last) :
+        packet_(packet), first_(first), last_(last)
+    {}
+
+    explicit operator bool() const { return packet_; }
+
+    size_t size() const { return last_ - first_; }
+    bool empty() const { return first_ == last_; }
+
+    const_iterator begin() const { return first_; }
+    const_iterator end() const { return last_; }
+    const_iterator cbegin() const { return first_; }
+    const_iterator cend() const { return last_; }
+
+    /** Bytes of the nested payload including its header. */
+    const uint8_t* packet() const { return packet_; }
+    size_t packetSize() const { return last_ - packet_; }
+
+    /** Copies the bytes into an owning payload. */
+    Payload payload() const { return Payload(first_, last_); }
+
+private:
+    const_iterator packet_;
+    const_iterator first_;
+    const_iterator last_;
+};
+
+
+template<>
+struct Pack<PayloadView>
+{
+    static size_t size(const PayloadView& value)
+    {
+        return value ? value.packetSize() : Payload::headerSize(0);
+    }
+
+    static void pack(const PayloadView& value, PackIt first, PackIt last)
+    {
+        if (!value) {
+            Payload::writeHeader(first, 0);
+            return;
+        }
+
+        assert(first + value.packetSize() <= last);
+        std::copy(value.packet(), value.packet() + value.packetSize(), first);
+    }
+
+    static ConstPackIt unpack(
+            PayloadView& value, ConstPackIt first, ConstPackIt last)
+    {
+        size_t size;
+        ConstPackIt it = Payload::readHeader(first, last, size);
+        assert(it && it + size <= last);
+
+        value = PayloadView(first, it, it + size);
+        return it + size;
+    }
+};
+
+
+/******************************************************************************/
+/* PACKED VECTOR VIEW                                                         */
+/******************************************************************************/
+
+/** Vector whose items are unpacked one at a time while iterating over it.
+    Using a view type for T (eg. PackedVectorView<StringView>) keeps the whole
+    scan free of allocations.
+
+    Items of variable size can only be reached through forward iteration while
+    items of fixed size can also be accessed randomly since their offset is
+    known.
+ */
+template<typename T>
+struct PackedVectorView
+{
+    typedef T value_type;
+
+    struct const_iterator
+    {
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        const_iterator() : it(nullptr), last(nullptr), next(nullptr) {}
+        const_iterator(ConstPackIt it, ConstPackIt last) :
+            it(it), last(last), next(nullptr)
+        {
+            load();
+        }
+
+        const T& operator* () const { return value; }
+        const T* operator-> () const { return &value; }
+
+        const_iterator& operator++ ()
+        {
+            it = next;
+            load();
+            return *this;
+        }
+
+        const_iterator operator++ (int)
+        {
+            const_iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        bool operator== (const const_iterator& other) const { return it == other.it; }
+        bool operator!= (const const_iterator& other) const { return it != other.it; }
+
+    private:
+
+        void load()
+        {
+            if (it == last) return;
+            next = slick::unpack(value, it, last);
+            assert(next <= last);
+        }
+
+        ConstPackIt it;
+        ConstPackIt last;
+        ConstPackIt next;
+        T value;
+    };
+
+    PackedVectorView() : size_(0), first_(nullptr), last_(nullptr) {}
+    PackedVectorView(size_t size, ConstPackIt first, ConstPackIt last) :
+        size_(size), first_(first), last_(last)
+    {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+
+    const_iterator begin() const { return const_iterator(first_, last_); }
+    const_iterator end() const { return const_iterator(last_, last_); }
+
+    template<typename U = T>
+    typename std::enable_if< details::IsFixedSize<U>::value, U >::type
+    operator[] (size_t i) const
+    {
+        assert(i < size_);
+        return slick::unpack<U>(first_ + i * details::FixedSize<U>::value, last_);
+    }
+
+    /** Packed bytes of the items excluding the header. */
+    ConstPackIt first() const { return first_; }
+    ConstPackIt last() const { return last_; }
+
+private:
+    size_t size_;
+    ConstPackIt first_;
+    ConstPackIt last_;
+};
+
+
+template<typename T>
+struct Pack< PackedVectorView<T> >
+{
+    typedef PackedVectorView<T> ViewT;
+
+    static size_t size(const ViewT& value)
+    {
+        return Payload::headerSize(value.size()) + (value.last() - value.first());
+    }
+
+    static void pack(const ViewT& value, PackIt first, PackIt last)
+    {
+        PackIt it = Payload::writeHeader(first, value.size());
+        assert(it + (value.last() - value.first()) <= last);
+        std::copy(value.first(), value.last(), it);
+    }
+
+    static ConstPackIt unpack(ViewT& value, ConstPackIt first, ConstPackIt last)
+    {
+        size_t size;
+        ConstPackIt it = Payload::readHeader(first, last, size);
+        assert(it);
+
+        ConstPackIt end = skip(it, last, size);
+        value = ViewT(size, it, end);
+        return end;
+    }
+
+private:
+
+    template<typename U = T>
+    static ConstPackIt skip(ConstPackIt it, ConstPackIt last, size_t size,
+            typename std::enable_if< details::IsFixedSize<U>::value >::type* = 0)
+    {
+        size_t bytes = size * details::FixedSize<U>::value;
+        assert(size_t(last - it) >= bytes);
+        (void) last;
+        return it + bytes;
+    }
+
+    template<typename U = T>
+    static ConstPackIt skip(ConstPackIt it, ConstPackIt last, size_t size,
+            typename std::enable_if< !details::IsFixedSize<U>::value >::type* = 0)
+    {
+        U item;
+        for (size_t i = 0; i < size; ++i) {
+            it = slick::unpack(item, it, last);
+            assert(it <= last);
+        }
+        return it;
+    }
+};
+
+} // slick
@@ -6,56 +6,163 @@
 */
 
 #include "payload.h"
+#include "lockless/alloc.h"
+#include "lockless/bits.h"
 
+#include <new>
 #include <algorithm>
-#include <limits>
 
 namespace slick {
 
+
+/******************************************************************************/
+/* POOLS                                                                      */
+/******************************************************************************/
+
+namespace {
+
+struct PoolTag {};
+
+template<size_t Size>
+struct Pool
+{
+    typedef lockless::AlignedAllocPolicy<Size, 16> Policy;
+    typedef lockless::BlockAlloc<Policy, PoolTag> Alloc;
+};
+
+struct PoolOps
+{
+    void* (*alloc)();
+    void (*free)(void*);
+};
+
+#define SLICK_PAYLOAD_POOL(size) \
+    { &Pool<size>::Alloc::allocBlock, &Pool<size>::Alloc::freeBlock }
+
+// Each thread has its own pages for every size class that it allocates from
+// and the pages are made up of at least 64 blocks so the largest size class
+// is kept fairly small to keep the memory overhead in check.
+enum { MinPoolShift = 6, MaxPoolShift = 14, NoPool = uint16_t(-1) };
+
+const PoolOps pools[] = {
+    SLICK_PAYLOAD_POOL(1 << 6),
+    SLICK_PAYLOAD_POOL(1 << 7),
+    SLICK_PAYLOAD_POOL(1 << 8),
+    SLICK_PAYLOAD_POOL(1 << 9),
+    SLICK_PAYLOAD_POOL(1 << 10),
+    SLICK_PAYLOAD_POOL(1 << 11),
+    SLICK_PAYLOAD_POOL(1 << 12),
+    SLICK_PAYLOAD_POOL(1 << 13),
+    SLICK_PAYLOAD_POOL(1 << 14),
+};
+
+#undef SLICK_PAYLOAD_POOL
+
+static_assert(
+        sizeof(pools) / sizeof(pools[0]) == MaxPoolShift - MinPoolShift + 1,
+        "missing size classes");
+
+size_t poolFor(size_t size)
+{
+    if (size > (1 << MaxPoolShift)) return NoPool;
+
+    size_t shift = lockless::log2(size - 1);
+    return shift < MinPoolShift ? 0 : shift - MinPoolShift;
+}
+
+} // namespace anonymous
+
 /******************************************************************************/
 /* PAYLOAD                                                                    */
 /******************************************************************************/
 
+uint8_t*
 Payload::
-Payload(size_t size)
+allocBlock(size_t size)
 {
-    assert(size < std::numeric_limits<SizeT>::max());
+    size_t pool = poolFor(size);
+    uint8_t* block;
 
-    size_t totalSize = size + sizeof(SizeT);
+    if (pool == NoPool) block = new uint8_t[size];
+    else {
+        block = static_cast<uint8_t*>(pools[pool].alloc());
+        if (!block) throw std::bad_alloc();
+    }
 
-    uint8_t* bytes = new uint8_t[totalSize];
-    bytes_ = bytes + sizeof(SizeT);
+    *reinterpret_cast<PoolT*>(block + sizeof(Refs)) = pool;
+    return block;
+}
 
-    *reinterpret_cast<SizeT*>(bytes) = size;
+void
+Payload::
+freeBlock(uint8_t* block)
+{
+    size_t pool = *reinterpret_cast<const PoolT*>(block + sizeof(Refs));
+
+    if (pool == NoPool) delete[] block;
+    else pools[pool].free(block);
 }
 
 
-Payload
 Payload::
-read(const uint8_t* buffer, size_t bufferSize)
+Payload(size_t size)
 {
-    auto size = *reinterpret_cast<const SizeT*>(buffer);
-    if (size + sizeof(SizeT) > bufferSize) return Payload();
+    if (size <= InlineSize) {
+        bytes_ = writeHeader(inline_, size);
+        return;
+    }
 
-    Payload data(size);
-    const uint8_t* first = buffer + sizeof(SizeT);
+    uint8_t* block = allocBlock(HeaderSize + size);
+    new (block) Refs(1);
 
-    std::copy(first, first + size, data.begin());
-    return std::move(data);
+    // Make sure that the start of the header slot can't be confused with the
+    // marker of the extended header.
+    uint8_t* header = block + sizeof(Refs) + sizeof(PoolT);
+    *reinterpret_cast<SizeT*>(header) = 0;
+
+    bytes_ = writeHeader(header + MaxHeaderSize - headerSize(size), size);
+    assert(bytes_ == block + HeaderSize);
 }
 
+
+Payload::
+Payload(const_iterator first, const_iterator last) :
+    Payload(size_t(last - first))
+{
+    std::copy(first, last, bytes_);
+}
+
+
 void
 Payload::
-copy(const Payload& other)
+shrink(size_t size)
+{
+    assert(unique());
+    assert(size <= this->size());
+
+    // The extended header could be replaced by a regular one in which case
+    // the marker has to go.
+    if (!isInline()) *reinterpret_cast<SizeT*>(bytes_ - MaxHeaderSize) = 0;
+
+    uint8_t* first = writeHeader(bytes_ - headerSize(size), size);
+    assert(first == bytes_);
+    (void) first;
+}
+
+
+Payload
+Payload::
+read(const uint8_t* buffer, size_t bufferSize)
 {
-    SizeT size = other.packetSize();
-    const uint8_t* start = other.packet();
+    size_t size;
+    const uint8_t* last = buffer + bufferSize;
 
-    std::unique_ptr<uint8_t[]> bytes(new uint8_t[size]);
-    std::copy(start, start + size, bytes.get());
+    const uint8_t* first = readHeader(buffer, last, size);
+    if (!first || size > size_t(last - first)) return Payload();
 
-    bytes_ = bytes.release() + 2;
-    assert(this->size() == other.size());
+    Payload data(size);
+    std::copy(first, first + size, data.begin());
+    return std::move(data);
 }
 
 } // slick
@@ -3,15 +3,16 @@
    FreeBSD-style copyright and disclaimer apply
 
    Payload seraizlization utilities.
-
-   Might want to consider just using shared_ptr to make everything much simpler.
 */
 
 #pragma once
 
 #include <memory>
+#include <atomic>
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 
 
 namespace slick {
@@ -22,11 +23,11 @@ namespace slick {
 
 /** Data layout looks like this:
 
-    +-------+--------------+
-    | SizeT | ... data ... |
-    +-------+--------------+
-    |       |
-    packet  bytes
+    +------+------+--------+-------+--------------+
+    | Refs | Pool | unused | SizeT | ... data ... |
+    +------+------+--------+-------+--------------+
+                           |       |
+                           packet  bytes
 
     We store things this way because when we transmit on the wire we'll need to
     know the size of the packet to properly reconstruct it. Keeping the size
@@ -35,35 +36,90 @@ namespace slick {
 
     This also explains the distinction between the packet() and bytes()
     functions.
+
+    Payloads that are too big to have their size stored in a SizeT use an
+    extended header instead which is made of a SizeT set to LargeMarker
+    followed by the size stored as a LargeSizeT:
+
+    +------+------+-------------+------------+--------------+
+    | Refs | Pool | LargeMarker | LargeSizeT | ... data ... |
+    +------+------+-------------+------------+--------------+
+                  |                          |
+                  packet                     bytes
+
+    Smaller payloads are therefore framed exactly as they were before the
+    extended header was introduced. Space for the largest header is always
+    reserved so that the start of the buffer can be found from the data alone.
+
+    Buffers are carved out of power-of-two size classes which are backed by
+    per-thread block allocators and Pool is the size class the buffer came
+    from. Buffers too large for any of the size classes go through operator
+    new instead. Either way, a buffer can be freed from any thread.
+
+    The buffer is reference counted which means that copying a payload only
+    bumps the counter and that a single buffer can sit in the send queues of
+    any number of connections. The flip side is that a payload must be treated
+    as immutable once it's been copied: begin() and end() are only meant to
+    fill in a freshly constructed payload.
+
+    Payloads of up to InlineSize bytes skip all of the above and are instead
+    framed directly within the object itself:
+
+    +--------+-------+--------------+
+    | bytes_ | SizeT | ... data ... |
+    +--------+-------+--------------+
+             |       |
+             packet  bytes
+
+    Copying an inline payload copies its bytes and, since the bytes move along
+    with the object, moving or copying an inline payload invalidates its
+    iterators.
  */
 struct Payload
 {
     typedef uint16_t SizeT;
+    typedef uint64_t LargeSizeT;
+    typedef std::atomic<uint32_t> Refs;
     typedef uint8_t* iterator;
     typedef const uint8_t* const_iterator;
 
+    enum {
+        LargeMarker = SizeT(-1),
+        MaxHeaderSize = sizeof(SizeT) + sizeof(LargeSizeT),
+
+        // Sized so that an inline payload fits in a single cache line.
+        InlineSize = 64 - sizeof(uint8_t*) - sizeof(SizeT),
+    };
+
 
     Payload() : bytes_(nullptr) {}
     explicit Payload(size_t size);
+    Payload(const_iterator first, const_iterator last);
     static Payload read(const uint8_t* buffer, size_t bufferSize);
 
+    /** Reduces the size of a payload that hasn't been shared yet. Meant for
+        buffers that are filled in incrementally before being handed out.
+     */
+    void shrink(size_t size);
+
 
     Payload(const Payload& other) { copy(other); }
     Payload& operator= (const Payload& other)
     {
+        if (this == &other) return *this;
+
         clear();
         copy(other);
         return *this;
     }
 
-    Payload(Payload&& other) noexcept : bytes_(other.bytes_)
-    {
-        other.bytes_ = nullptr;
-    }
+    Payload(Payload&& other) noexcept { steal(other); }
     Payload& operator= (Payload&& other) noexcept
     {
+        if (this == &other) return *this;
+
         clear();
-        std::swap(bytes_, other.bytes_);
+        steal(other);
         return *this;
     }
 
@@ -71,12 +127,27 @@ struct Payload
     void clear()
     {
         if (!bytes_) return;
-        delete[] start();
+
+        if (!isInline() && refs().fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            refs().~Refs();
+            freeBlock(block());
+        }
+
         bytes_ = nullptr;
     }
 
     operator bool() const { return bytes_; }
 
+    /** Returns true if no other payload shares this buffer. */
+    bool unique() const
+    {
+        return !bytes_ || isInline() ||
+            refs().load(std::memory_order_acquire) == 1;
+    }
+
+    /** Returns true if the bytes are stored within the object. */
+    bool isInline() const { return bytes_ == inline_ + sizeof(SizeT); }
+
     iterator begin() { return bytes_; }
     const_iterator cbegin() const { return bytes_; }
 
@@ -85,27 +156,110 @@ struct Payload
 
 
     const uint8_t* bytes() const { return bytes_; }
-    size_t size() const { return *reinterpret_cast<const SizeT*>(start()); }
+    size_t size() const
+    {
+        // The extended header would overlap bytes_ for inline payloads.
+        const uint8_t* header = bytes_ - MaxHeaderSize;
+        if (!isInline() && *reinterpret_cast<const SizeT*>(header) == LargeMarker)
+            return *reinterpret_cast<const LargeSizeT*>(header + sizeof(SizeT));
+        return *reinterpret_cast<const SizeT*>(bytes_ - sizeof(SizeT));
+    }
+
+    const uint8_t* packet() const
+    {
+        return bytes_ ? bytes_ - headerSize(size()) : nullptr;
+    }
 
-    const uint8_t* packet() const { return bytes_ ? start() : nullptr; }
     size_t packetSize() const
     {
-        return bytes_ ? pSize(start()) + sizeof(SizeT) : 0ULL;
+        if (!bytes_) return 0;
+
+        size_t size = this->size();
+        return headerSize(size) + size;
+    }
+
+
+    /** Size of the header used to frame a payload of the given size. */
+    static size_t headerSize(size_t size)
+    {
+        return size < LargeMarker ? sizeof(SizeT) : size_t(MaxHeaderSize);
+    }
+
+    /** Writes the header for a payload of the given size and returns an
+        iterator to the first byte of the payload.
+     */
+    static uint8_t* writeHeader(uint8_t* first, size_t size)
+    {
+        if (size < LargeMarker) {
+            *reinterpret_cast<SizeT*>(first) = size;
+            return first + sizeof(SizeT);
+        }
+
+        *reinterpret_cast<SizeT*>(first) = LargeMarker;
+        *reinterpret_cast<LargeSizeT*>(first + sizeof(SizeT)) = size;
+        return first + MaxHeaderSize;
+    }
+
+    /** Reads the header at the start of the [first, last) range and returns an
+        iterator to the first byte of the payload. Returns nullptr if the range
+        doesn't contain the entire header.
+     */
+    static const uint8_t* readHeader(
+            const uint8_t* first, const uint8_t* last, size_t& size)
+    {
+        if (size_t(last - first) < sizeof(SizeT)) return nullptr;
+
+        SizeT value = *reinterpret_cast<const SizeT*>(first);
+        if (value != LargeMarker) {
+            size = value;
+            return first + sizeof(SizeT);
+        }
+
+        if (size_t(last - first) < MaxHeaderSize) return nullptr;
+        size = *reinterpret_cast<const LargeSizeT*>(first + sizeof(SizeT));
+        return first + MaxHeaderSize;
     }
 
 private:
 
-    void copy(const Payload& other);
+    typedef uint16_t PoolT;
+
+    // Keeps the data 16 bytes aligned.
+    enum { HeaderSize = sizeof(Refs) + sizeof(PoolT) + MaxHeaderSize };
+
+    static uint8_t* allocBlock(size_t size);
+    static void freeBlock(uint8_t* block);
 
-    uint8_t* start() { return bytes_ - sizeof(SizeT); }
-    uint8_t* start() const { return bytes_ - sizeof(SizeT); }
+    uint8_t* block() const { return bytes_ - HeaderSize; }
+    Refs& refs() const { return *reinterpret_cast<Refs*>(block()); }
+
+    // The following assume that this payload is empty.
+
+    void copy(const Payload& other)
+    {
+        if (other.isInline()) copyInline(other);
+        else {
+            bytes_ = other.bytes_;
+            if (bytes_) refs().fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void steal(Payload& other)
+    {
+        if (other.isInline()) copyInline(other);
+        else bytes_ = other.bytes_;
+
+        other.bytes_ = nullptr;
+    }
 
-    SizeT& pSize(uint8_t* start) const
+    void copyInline(const Payload& other)
     {
-        return *reinterpret_cast<SizeT*>(start);
+        std::memcpy(inline_, other.inline_, sizeof(SizeT) + other.size());
+        bytes_ = inline_ + sizeof(SizeT);
     }
 
     uint8_t* bytes_;
+    uint8_t inline_[sizeof(SizeT) + InlineSize];
 };
 
 } // slick
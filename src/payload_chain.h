@@ -0,0 +1,162 @@
+/* payload_chain.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 21 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Frame assembled out of multiple payloads.
+*/
+
+#pragma once
+
+#include "payload.h"
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <sys/uio.h>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* PAYLOAD CHAIN                                                              */
+/******************************************************************************/
+
+/** Single frame whose bytes are spread over multiple payloads. The fragments
+    reference the payloads instead of copying them which means that wrapping a
+    large payload in a small header only costs the header:
+
+        PayloadChain chain(pack(header));
+        chain.appendPacket(body);
+
+    The frame is laid out on the wire exactly as packAll(header, body) would've
+    laid it out so the other end can't tell the difference. The header of the
+    frame is computed from the size of the fragments and is kept within the
+    chain itself.
+
+    The payloads must be treated as immutable once they're part of a chain.
+ */
+struct PayloadChain
+{
+    PayloadChain() : size_(0) { Payload::writeHeader(header, 0); }
+
+    explicit PayloadChain(Payload data) : size_(0)
+    {
+        Payload::writeHeader(header, 0);
+        append(std::move(data));
+    }
+
+    explicit operator bool() const { return size_; }
+
+    size_t size() const { return size_; }
+    size_t packetSize() const { return Payload::headerSize(size_) + size_; }
+    size_t fragments() const { return fragments_.size(); }
+
+    /** Appends the bytes of the payload, leaving its header behind. */
+    void append(Payload data)
+    {
+        if (!data) return;
+
+        size_t size = data.size();
+        append(std::move(data), Payload::headerSize(size), size);
+    }
+
+    /** Appends the payload along with its header which is how a payload is
+        packed within another.
+     */
+    void appendPacket(Payload data)
+    {
+        size_t size = data.packetSize();
+        append(std::move(data), 0, size);
+    }
+
+    /** Appends size bytes of the packet of the payload starting at offset. */
+    void append(Payload data, size_t offset, size_t size)
+    {
+        if (!size) return;
+        assert(offset + size <= data.packetSize());
+
+        fragments_.emplace_back(std::move(data), offset, size);
+
+        size_ += size;
+        Payload::writeHeader(header, size_);
+    }
+
+    /** Copies the bytes of the frame, header excluded, to dest and returns the
+        end of the copied range.
+     */
+    uint8_t* copy(uint8_t* dest) const
+    {
+        for (const auto& fragment : fragments_)
+            dest = std::copy(fragment.first(), fragment.last(), dest);
+        return dest;
+    }
+
+    /** Copies the chain into a single contiguous payload. */
+    Payload flatten() const
+    {
+        Payload data(size_);
+        copy(data.begin());
+        return data;
+    }
+
+    /** Fills up to n iovecs with the bytes of the packet, header included,
+        that come after the first offset bytes. Returns the number of iovecs
+        that were used. The iovecs point within the chain and are therefore
+        invalidated by moving or modifying the chain.
+     */
+    size_t iovecs(size_t offset, struct iovec* iov, size_t n) const
+    {
+        size_t i = 0;
+        size_t headerSize = Payload::headerSize(size_);
+
+        if (offset < headerSize) {
+            if (!n) return 0;
+
+            iov[i].iov_base = const_cast<uint8_t*>(header + offset);
+            iov[i].iov_len = headerSize - offset;
+            i++;
+
+            offset = 0;
+        }
+        else offset -= headerSize;
+
+        for (const auto& fragment : fragments_) {
+            if (i == n) break;
+
+            if (offset >= fragment.size) {
+                offset -= fragment.size;
+                continue;
+            }
+
+            iov[i].iov_base = const_cast<uint8_t*>(fragment.first() + offset);
+            iov[i].iov_len = fragment.size - offset;
+            i++;
+
+            offset = 0;
+        }
+
+        return i;
+    }
+
+private:
+
+    struct Fragment
+    {
+        Fragment(Payload data, size_t offset, size_t size) :
+            data(std::move(data)), offset(offset), size(size)
+        {}
+
+        Payload data;
+        size_t offset; // relative to the packet of the payload.
+        size_t size;
+
+        const uint8_t* first() const { return data.packet() + offset; }
+        const uint8_t* last() const { return first() + size; }
+    };
+
+    std::vector<Fragment> fragments_;
+    size_t size_;
+    uint8_t header[Payload::MaxHeaderSize];
+};
+
+} // slick
@@ -38,11 +38,8 @@ std::ostream& operator<<(
 /******************************************************************************/
 
 PeerDiscovery::ConnState::
-ConnState() : fd(0), version(0), isFetch(false)
-{
-    static std::atomic<size_t> idCounter{0};
-    id = ++idCounter;
-}
+ConnState() : id(0), version(0), isFetch(false)
+{}
 
 
 /******************************************************************************/
@@ -86,7 +83,7 @@ PeerDiscovery(const std::vector<Address>& seeds, Port port) :
 
     using namespace std::placeholders;
 
-    endpoint.onPayload = bind(&PeerDiscovery::onPayload, this, _1, _2);
+    endpoint.onPayloadView = bind(&PeerDiscovery::onPayload, this, _1, _2, _3);
     endpoint.onNewConnection = bind(&PeerDiscovery::onConnect, this, _1);
     endpoint.onLostConnection = bind(&PeerDiscovery::onDisconnect, this, _1);
     poller.add(endpoint);
@@ -121,15 +118,13 @@ poll(size_t timeoutMs)
 
 void
 PeerDiscovery::
-onPayload(int fd, const Payload& data)
+onPayload(ConnId id, ConstPackIt it, ConstPackIt last)
 {
-    auto connIt = connections.find(fd);
+    auto connIt = connections.find(id);
     assert(connIt != connections.end());
     auto& conn = connIt->second;
 
 
-    auto it = data.cbegin(), last = data.cend();
-
     if (!conn.initialized()) it = onInit(conn, it, last);
 
     while (it != last) {
@@ -227,42 +222,42 @@ retractImpl(const std::string& key)
 
 void
 PeerDiscovery::
-onConnect(int fd)
+onConnect(ConnId id)
 {
-    auto& conn = connections[fd];
-    conn.fd = fd;
-    connExpiration.emplace_back(fd, conn.id, lockless::wall() * 1000);
-    print(myId, "ocon", fd, conn.id, conn.isFetch, conn.nodeId);
+    auto& conn = connections[id];
+    conn.id = id;
+    connExpiration.emplace_back(id, lockless::wall() * 1000);
+    print(myId, "ocon", id, conn.isFetch, conn.nodeId);
 
     auto head = std::make_tuple(Msg::Init, Msg::Version, myId);
     Payload data;
 
     if (conn.pendingFetch.empty()) {
-        edges.insert(conn.fd);
-        print(myId, "send", "init", fd, Msg::Version, myId);
+        edges.insert(conn.id);
+        print(myId, "send", "init", id, Msg::Version, myId);
         data = pack(head);
     }
     else {
         data = packAll(head, Msg::Fetch, conn.pendingFetch);
-        print(myId, "send", "init", fd, Msg::Version, myId, "ftch", conn.pendingFetch, data);
+        print(myId, "send", "init", id, Msg::Version, myId, "ftch", conn.pendingFetch, data);
         conn.pendingFetch.clear();
     }
 
-    endpoint.send(fd, std::move(data));
+    endpoint.send(id, std::move(data));
 }
 
 
 void
 PeerDiscovery::
-onDisconnect(int fd)
+onDisconnect(ConnId id)
 {
-    auto it = connections.find(fd);
+    auto it = connections.find(id);
     assert(it != connections.end());
 
     const auto& conn = it->second;
-    print(myId, "disc", fd, conn.id, conn.nodeId, conn.version);
+    print(myId, "disc", id, conn.nodeId, conn.version);
 
-    edges.erase(conn.fd);
+    edges.erase(conn.id);
     connectedNodes.erase(conn.nodeId);
     connections.erase(it);
 }
@@ -277,22 +272,22 @@ onInit(ConnState& conn, ConstPackIt it, ConstPackIt last)
     it = unpackAll(it, last, init, conn.version, nodeId);
 
     if (init != Msg::Init) {
-        print(myId, "!err", "init-wrong-head", conn.fd, init, size_t(last - it));
-        endpoint.disconnect(conn.fd);
+        print(myId, "!err", "init-wrong-head", conn.id, init, size_t(last - it));
+        endpoint.disconnect(conn.id);
         return last;
     }
     assert(conn.version == Msg::Version);
 
-    print(myId, "recv", "init", conn.fd, conn.version, nodeId, it == last);
+    print(myId, "recv", "init", conn.id, conn.version, nodeId, it == last);
 
     if (!conn.nodeId) {
         conn.nodeId = nodeId;
-        connectedNodes[nodeId] = conn.fd;
+        connectedNodes[nodeId] = conn.id;
     }
     else if (nodeId != conn.nodeId) {
         print(myId, "!err", "init-wrong-id",
-                conn.fd, nodeId.toString(), conn.nodeId.toString());
-        endpoint.disconnect(conn.fd);
+                conn.id, nodeId.toString(), conn.nodeId.toString());
+        endpoint.disconnect(conn.id);
         return last;
     }
 
@@ -304,20 +299,20 @@ onInit(ConnState& conn, ConstPackIt it, ConstPackIt last)
         if (type == Msg::Fetch) return it;
     }
 
-    int fd = conn.fd;
-    sendInitQueries(fd);
-    sendInitKeys(fd);
-    sendInitNodes(fd);
+    ConnId id = conn.id;
+    sendInitQueries(id);
+    sendInitKeys(id);
+    sendInitNodes(id);
 
     return it;
 }
 
 void
 PeerDiscovery::
-sendInitQueries(int fd)
+sendInitQueries(ConnId id)
 {
     if (watches.empty()) return;
-    assert(connections.count(fd));
+    assert(connections.count(id));
 
     std::vector<QueryItem> items;
     items.reserve(watches.size());
@@ -325,17 +320,17 @@ sendInitQueries(int fd)
     for (const auto& watch : watches)
         items.emplace_back(watch.first);
 
-    print(myId, "send", "qury", fd, myNode, items);
+    print(myId, "send", "qury", id, myNode, items);
     auto Msg = packAll(Msg::Query, myNode, items);
-    endpoint.send(fd, std::move(Msg));
+    endpoint.send(id, std::move(Msg));
 }
 
 void
 PeerDiscovery::
-sendInitKeys(int fd)
+sendInitKeys(ConnId id)
 {
     if (data.empty()) return;
-    assert(connections.count(fd));
+    assert(connections.count(id));
 
     std::vector<KeyItem> items;
     items.reserve(data.size());
@@ -343,15 +338,15 @@ sendInitKeys(int fd)
     for (const auto& key : data)
         items.emplace_back(key.first, key.second.id, myNode, ttl_);
 
-    print(myId, "send", "keys", fd, items);
-    endpoint.send(fd, packAll(Msg::Keys, items));
+    print(myId, "send", "keys", id, items);
+    endpoint.send(id, packAll(Msg::Keys, items));
 }
 
 void
 PeerDiscovery::
-sendInitNodes(int fd)
+sendInitNodes(ConnId id)
 {
-    assert(connections.count(fd));
+    assert(connections.count(id));
 
     double now = lockless::wall();
     size_t numPicks = lockless::log2(nodes.size());
@@ -367,8 +362,8 @@ sendInitNodes(int fd)
         items.emplace_back(node.id, node.addrs, ttl);
     }
 
-    print(myId, "send", "node", fd, items);
-    endpoint.send(fd, packAll(Msg::Nodes, items));
+    print(myId, "send", "node", id, items);
+    endpoint.send(id, packAll(Msg::Nodes, items));
 }
 
 
@@ -379,7 +374,7 @@ onKeys(ConnState& conn, ConstPackIt it, ConstPackIt last)
     std::vector<KeyItem> items;
     it = unpack(items, it, last);
 
-    print(myId, "recv", "keys", conn.fd, items);
+    print(myId, "recv", "keys", conn.id, items);
 
     std::vector<KeyItem> toForward;
     toForward.reserve(items.size());
@@ -415,7 +410,7 @@ onKeys(ConnState& conn, ConstPackIt it, ConstPackIt last)
     }
 
     if (!toForward.empty()) {
-        print(myId, "fwrd", "keys", conn.fd, toForward);
+        print(myId, "fwrd", "keys", conn.id, toForward);
         endpoint.multicast(edges, packAll(Msg::Keys, toForward));
     }
 
@@ -431,7 +426,7 @@ onQuery(ConnState& conn, ConstPackIt it, ConstPackIt last)
     std::vector<QueryItem> items;
     it = unpackAll(it, last, node, items);
 
-    print(myId, "recv", "qury", conn.fd, node, items);
+    print(myId, "recv", "qury", conn.id, node, items);
 
     std::vector<KeyItem> reply;
     reply.reserve(items.size());
@@ -449,8 +444,8 @@ onQuery(ConnState& conn, ConstPackIt it, ConstPackIt last)
     }
 
     if (!reply.empty()) {
-        print(myId, "repl", "keys", conn.fd, reply);
-        endpoint.send(conn.fd, packAll(Msg::Keys, reply));
+        print(myId, "repl", "keys", conn.id, reply);
+        endpoint.send(conn.id, packAll(Msg::Keys, reply));
     }
 
     return it;
@@ -464,7 +459,7 @@ onNodes(ConnState& conn, ConstPackIt it, ConstPackIt last)
     std::vector<NodeItem> items;
     it = unpack(items, it, last);
 
-    print(myId, "recv", "node", conn.fd, items);
+    print(myId, "recv", "node", conn.id, items);
 
     std::vector<NodeItem> toForward;
     toForward.reserve(items.size());
@@ -490,7 +485,7 @@ onNodes(ConnState& conn, ConstPackIt it, ConstPackIt last)
     }
 
     if (!toForward.empty()) {
-        print(myId, "fwrd", "node", conn.fd, toForward);
+        print(myId, "fwrd", "node", conn.id, toForward);
         endpoint.multicast(edges, packAll(Msg::Nodes, toForward));
     }
 
@@ -509,12 +504,10 @@ sendFetch(const std::string& key, const UUID& keyId, const NodeAddress& node)
     auto socket = Socket::connect(node);
     if (!socket) return;
 
-    int fd = socket.fd();
-    print(myId, "conn", fd, node);
+    ConnId id = endpoint.connect(std::move(socket));
+    print(myId, "conn", id, node);
 
-    assert(!connections.count(fd));
-    connections[fd].fetch(key, keyId);
-    endpoint.connect(std::move(socket));
+    connections[id].fetch(key, keyId);
 }
 
 ConstPackIt
@@ -524,7 +517,7 @@ onFetch(ConnState& conn, ConstPackIt it, ConstPackIt last)
     std::vector<FetchItem> items;
     it = unpack(items, it, last);
 
-    print(myId, "recv", "ftch", conn.fd, items);
+    print(myId, "recv", "ftch", conn.id, items);
 
     for (const auto& blah : data)
         print(myId, "kydb", blah.first, blah.second.id, blah.second.data);
@@ -544,8 +537,8 @@ onFetch(ConnState& conn, ConstPackIt it, ConstPackIt last)
     }
 
     if (!reply.empty()) {
-        print(myId, "repl", "data", conn.fd, reply);
-        endpoint.send(conn.fd, packAll(Msg::Data, reply));
+        print(myId, "repl", "data", conn.id, reply);
+        endpoint.send(conn.id, packAll(Msg::Data, reply));
     }
 
     return last;
@@ -557,12 +550,12 @@ PeerDiscovery::
 onData(ConnState& conn, ConstPackIt it, ConstPackIt last)
 {
     // Make sure we disconnect when we're done.
-    auto connGuard = guard([&] { endpoint.disconnect(conn.fd); });
+    auto connGuard = guard([&] { endpoint.disconnect(conn.id); });
 
     std::vector<DataItem> items;
     it = unpack(items, it, last);
 
-    print(myId, "recv", "data", conn.fd, items);
+    print(myId, "recv", "data", conn.id, items);
 
     for (auto& item : items) {
         std::string key;
@@ -674,29 +667,27 @@ randomDisconnect(double now)
 
     // Need to defer the call because the call could invalidate our connection
     // iterator through our onLostConnection callback.
-    std::vector<int> toDisconnect;
+    std::vector<ConnId> toDisconnect;
     toDisconnect.reserve(disconnects);
 
     while(disconnects) {
         const auto& item = connExpiration.front();
         if (item.time + connExpThresh_ >= now * 1000) break;
 
-        size_t id = item.id;
-        int fd = item.fd;
+        ConnId id = item.id;
         connExpiration.pop_front();
 
-        auto it = connections.find(item.fd);
-        if (it == connections.end() || it->second.id != id) continue;
+        if (!connections.count(id)) continue;
 
-        toDisconnect.push_back(fd);
+        toDisconnect.push_back(id);
         disconnects--;
     }
 
     if (!toDisconnect.empty())
         print(myId, "disc", toDisconnect);
 
-    for (auto fd : toDisconnect)
-        endpoint.disconnect(fd);
+    for (ConnId id : toDisconnect)
+        endpoint.disconnect(id);
 }
 
 void
@@ -717,15 +708,13 @@ randomConnect(double now)
         auto connIt = connectedNodes.find(nodeIt->id);;
         if (connIt != connectedNodes.end()) continue;
 
-        auto socket = Socket::connect(nodeIt->addrs);
-        int fd = socket.fd();
-        if (!fd) continue;
+        ConnId id = endpoint.connect(nodeIt->addrs);
+        if (!id) continue;
 
-        connectedNodes.emplace(nodeIt->id, fd);
-        connections[fd].nodeId = nodeIt->id;
+        connectedNodes.emplace(nodeIt->id, id);
+        connections[id].nodeId = nodeIt->id;
 
-        print(myId, "rcon", fd, *nodeIt, connects);
-        endpoint.connect(std::move(socket));
+        print(myId, "rcon", id, *nodeIt, connects);
     }
 }
 
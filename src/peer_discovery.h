@@ -71,8 +71,7 @@ private:
 
     struct ConnState
     {
-        int fd;
-        size_t id; // sady, fds aren't unique so this is to dedup them.
+        ConnId id;
         UUID nodeId;
         uint32_t version;
 
@@ -92,12 +91,11 @@ private:
 
     struct ConnExpItem
     {
-        int fd;
-        size_t id;
+        ConnId id;
         double time;
 
-        ConnExpItem(int fd = 0, size_t id = 0, double time = 0) :
-            fd(fd), id(id), time(time)
+        ConnExpItem(ConnId id = 0, double time = 0) :
+            id(id), time(time)
         {}
     };
 
@@ -207,10 +205,10 @@ private:
     SortedVector<Item> nodes;
     std::vector<Address> seeds;
 
-    std::unordered_map<int, ConnState> connections;
-    std::unordered_map<UUID, int> connectedNodes;
+    std::unordered_map<ConnId, ConnState> connections;
+    std::unordered_map<UUID, ConnId> connectedNodes;
     std::deque<ConnExpItem> connExpiration;
-    SortedVector<int> edges;
+    SortedVector<ConnId> edges;
 
     std::unordered_map<std::string, std::map<UUID, Fetch> > fetches;
     std::deque<FetchExp> fetchExpiration;
@@ -228,9 +226,9 @@ private:
 
     double timerPeriod(size_t ms);
     void onTimer(size_t);
-    void onPayload(int fd, const Payload& data);
-    void onConnect(int fd);
-    void onDisconnect(int fd);
+    void onPayload(ConnId id, ConstPackIt first, ConstPackIt last);
+    void onConnect(ConnId id);
+    void onDisconnect(ConnId id);
 
     ConstPackIt onInit (ConnState& conn, ConstPackIt first, ConstPackIt last);
     ConstPackIt onKeys (ConnState& conn, ConstPackIt first, ConstPackIt last);
@@ -239,9 +237,9 @@ private:
     ConstPackIt onFetch(ConnState& conn, ConstPackIt first, ConstPackIt last);
     ConstPackIt onData (ConnState& conn, ConstPackIt first, ConstPackIt last);
 
-    void sendInitQueries(int fd);
-    void sendInitKeys(int fd);
-    void sendInitNodes(int fd);
+    void sendInitQueries(ConnId id);
+    void sendInitKeys(ConnId id);
+    void sendInitNodes(ConnId id);
     void sendFetch(const std::string& key, const UUID& keyId, const NodeAddress& node);
 
     std::pair<bool, UUID> expireItem(SortedVector<Item>& list, double now);
@@ -9,6 +9,7 @@
 #include "utils.h"
 
 #include <cstring>
+#include <algorithm>
 #include <sys/epoll.h>
 
 namespace slick {
@@ -52,6 +53,14 @@ del(int fd)
 {
     int ret = epoll_ctl(fd_, EPOLL_CTL_DEL, fd, nullptr);
     SLICK_CHECK_ERRNO(ret != -1, "Epoll.epoll_ctl.del");
+
+    // Events for the fd that were already fetched but not yet read would
+    // otherwise outlive it and could even be mistaken for a new fd that
+    // happens to reuse the number.
+    auto last = std::remove_if(
+            events + nextEvent, events + numEvents,
+            [=] (const struct epoll_event& ev) { return ev.data.fd == fd; });
+    numEvents = last - events;
 }
 
 
@@ -35,6 +35,9 @@ struct Epoll
     struct epoll_event next();
     bool poll(int timeoutMs = 0);
 
+    /** True if events from the last epoll_wait are still waiting to be read. */
+    bool ready() const { return nextEvent < numEvents; }
+
     int fd() const { return fd_; }
 
 private:
@@ -133,6 +136,14 @@ StopPollingFn stopPollingFn(T& object)
 /* SOURCE POLLER                                                              */
 /******************************************************************************/
 
+/** Dispatches to the poll function of whichever of its sources is ready.
+
+    Sticks to epoll even when the endpoints use the io_uring backend: sources
+    are a handful of long-lived fds that do their own I/O so all that's waited
+    on here is readiness which io_uring would only reimplement with poll ops
+    that have to be re-armed. A uring endpoint exposes its ring through its
+    own epoll fd so it can be added like any other source.
+ */
 struct SourcePoller
 {
     SourcePoller() {}
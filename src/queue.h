@@ -2,19 +2,23 @@
    Rémi Attab (remi.attab@gmail.com), 30 Nov 2013
    FreeBSD-style copyright and disclaimer apply
 
-   Partially lock-free queue specialized for the defer mechanism.
+   Bounded queues specialized for the defer mechanism.
 */
 
 #pragma once
 
 #include "utils.h"
 #include "lockless/lock.h"
+#include "lockless/arch.h"
 
 #include <array>
 #include <atomic>
 #include <utility>
 #include <mutex>
 #include <cassert>
+#include <algorithm>
+#include <sched.h>
+#include <time.h>
 
 namespace slick {
 
@@ -23,6 +27,10 @@ namespace slick {
 /* QUEUE                                                                      */
 /******************************************************************************/
 
+/** Multi-producer single-consumer queue where producers are serialized by a
+    spin lock. Superseded by MpscQueue but kept around as a baseline for the
+    queue_perf benchmark.
+ */
 template<typename T, size_t Size>
 struct Queue
 {
@@ -90,4 +98,255 @@ private:
 };
 
 
+/******************************************************************************/
+/* MPSC QUEUE                                                                 */
+/******************************************************************************/
+
+/** Lock-free bounded multi-producer single-consumer queue.
+
+    Each slot carries a sequence number which tells the producers whether the
+    slot is free for the current lap around the ring and tells the consumer
+    whether its value was published. Producers only contend on the CAS of the
+    write cursor and never wait on each other once a slot is claimed.
+
+    empty() and pop() may only be called by the consumer. Note that a producer
+    that has claimed a slot but not yet published it will make the queue look
+    empty until it's done which is fine for Defer since every push is followed
+    by a signal.
+ */
+template<typename T, size_t Size>
+struct MpscQueue
+{
+    static_assert(Size && !(Size & (Size - 1)), "Size must be a power of 2");
+
+    MpscQueue() : write(0), read(0)
+    {
+        for (size_t i = 0; i < Size; ++i)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    constexpr size_t capacity() const { return Size; }
+
+    /** Only an approximation when called outside of the consumer thread. */
+    size_t size() const
+    {
+        return write.load(std::memory_order_relaxed) - read;
+    }
+
+    bool empty() const
+    {
+        const Slot& slot = slots[read & Mask];
+        return slot.seq.load(std::memory_order_acquire) != read + 1;
+    }
+
+    T pop()
+    {
+        assert(!empty());
+
+        Slot& slot = slots[read & Mask];
+        T val = std::move(slot.value);
+
+        slot.seq.store(read + Size, std::memory_order_release);
+        read++;
+
+        return val;
+    }
+
+    /** The value is only moved from if the push succeeds. */
+    template<typename Val>
+    bool push(Val&& val)
+    {
+        size_t pos = write.load(std::memory_order_relaxed);
+
+        while (true) {
+            Slot& slot = slots[pos & Mask];
+
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            ssize_t diff = ssize_t(seq) - ssize_t(pos);
+
+            if (!diff) {
+                if (!write.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed))
+                    continue;
+
+                slot.value = std::forward<Val>(val);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            // The consumer hasn't freed the slot from the previous lap.
+            if (diff < 0) return false;
+
+            pos = write.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+
+    enum { Mask = Size - 1 };
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    // Padding instead of alignment attributes to avoid requiring over-aligned
+    // allocations of everything that embeds a queue.
+    std::atomic<size_t> write;
+    uint8_t padWrite[lockless::CacheLine - sizeof(std::atomic<size_t>)];
+
+    size_t read;
+    uint8_t padRead[lockless::CacheLine - sizeof(size_t)];
+
+    std::array<Slot, Size> slots;
+};
+
+
+/******************************************************************************/
+/* SPSC QUEUE                                                                 */
+/******************************************************************************/
+
+/** Lock-free bounded single-producer single-consumer queue which stores its
+    values inline.
+
+    Each side only writes its own cursor and keeps a cached copy of the other
+    side's cursor which is only refreshed when the queue looks full or empty.
+    The cursors' cache lines therefore don't bounce between the two threads on
+    every operation.
+
+    push() may only be called by the producer while empty() and pop() may only
+    be called by the consumer.
+ */
+template<typename T, size_t Size>
+struct SpscQueue
+{
+    static_assert(Size && !(Size & (Size - 1)), "Size must be a power of 2");
+
+    SpscQueue() : write(0), readCache(0), read(0), writeCache(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    constexpr size_t capacity() const { return Size; }
+
+    /** Only an approximation when called outside of the consumer thread. */
+    size_t size() const
+    {
+        return write.load(std::memory_order_relaxed)
+            - read.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const
+    {
+        size_t pos = read.load(std::memory_order_relaxed);
+        if (pos != writeCache) return false;
+
+        writeCache = write.load(std::memory_order_acquire);
+        return pos == writeCache;
+    }
+
+    T pop()
+    {
+        assert(!empty());
+
+        size_t pos = read.load(std::memory_order_relaxed);
+        T val = std::move(slots[pos & Mask]);
+
+        read.store(pos + 1, std::memory_order_release);
+        return val;
+    }
+
+    /** The value is only moved from if the push succeeds. */
+    template<typename Val>
+    bool push(Val&& val)
+    {
+        size_t pos = write.load(std::memory_order_relaxed);
+
+        if (pos - readCache == Size) {
+            readCache = read.load(std::memory_order_acquire);
+            if (pos - readCache == Size) return false;
+        }
+
+        slots[pos & Mask] = std::forward<Val>(val);
+        write.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+
+    enum { Mask = Size - 1 };
+
+    // Producer side.
+    std::atomic<size_t> write;
+    size_t readCache;
+    uint8_t padWrite[lockless::CacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+    // Consumer side.
+    std::atomic<size_t> read;
+    mutable size_t writeCache;
+    uint8_t padRead[lockless::CacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+    std::array<T, Size> slots;
+};
+
+
+/******************************************************************************/
+/* BACKOFF                                                                    */
+/******************************************************************************/
+
+/** Wait policy for producers that find a queue full. Spins for SpinLimit
+    attempts in case the consumer is about to catch up, yields until YieldLimit
+    and then sleeps for exponentially longer periods, up to MaxSleepUs, so that
+    a stalled consumer doesn't end up burning every producer's core.
+
+    Policies are passed as template parameters to BasicDefer and
+    BasicThreadLocalDefer. Anything default constructible with a call operator
+    which waits a little bit more on every call will do.
+ */
+template<size_t SpinLimit, size_t YieldLimit, size_t MaxSleepUs>
+struct BasicBackoff
+{
+    static_assert(SpinLimit <= YieldLimit, "Spins must come before yields");
+
+    BasicBackoff() : attempts(0) {}
+
+    void reset() { attempts = 0; }
+
+    void operator() ()
+    {
+        if (attempts < SpinLimit) __builtin_ia32_pause();
+
+        else if (attempts < YieldLimit) sched_yield();
+
+        else {
+            size_t shift = std::min<size_t>(attempts - YieldLimit, 10);
+            size_t sleepUs = std::min<size_t>(size_t(1) << shift, MaxSleepUs);
+
+            struct timespec ts = { 0, long(sleepUs * 1000) };
+            nanosleep(&ts, nullptr);
+        }
+
+        attempts++;
+    }
+
+private:
+    size_t attempts;
+};
+
+/** Default policy which is a reasonable compromise for shared cores. */
+typedef BasicBackoff<1 << 6, 1 << 7, 1 << 10> Backoff;
+
+/** Never gives up the core which is the lowest latency option when producers
+    have cores of their own.
+ */
+typedef BasicBackoff<size_t(-1), size_t(-1), 0> SpinBackoff;
+
+/** Never spins nor sleeps which is friendlier to oversubscribed machines. */
+typedef BasicBackoff<0, size_t(-1), 0> YieldBackoff;
+
+
 } // slick
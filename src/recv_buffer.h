@@ -0,0 +1,135 @@
+/* recv_buffer.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 15 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Persistent receive buffer for stream connections.
+*/
+
+#pragma once
+
+#include "buffer_arena.h"
+
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* RECV BUFFER                                                                */
+/******************************************************************************/
+
+/** Buffer that lives alongside a connection and accumulates bytes across
+    multiple calls to recv.
+
+    +-----------+--------------+-------------+
+    | consumed  | ... data ... | available   |
+    +-----------+--------------+-------------+
+                |              |
+                begin          end/tail
+
+    Complete frames are parsed straight out of [begin, end) and consumed in
+    place. Whatever is left over (usually a partial frame) stays where it is
+    until the tail runs out of room at which point it's moved back to the front
+    of the buffer. This means that a partial frame is moved at most once per
+    fill of the buffer instead of once per call to recv.
+
+    The storage can also be borrowed from an arena in which case the capacity
+    is the buffer size of the arena and the arena must outlive the buffer.
+ */
+struct RecvBuffer
+{
+    RecvBuffer() : capacity_(0), first(0), last(0) {}
+
+    explicit RecvBuffer(size_t capacity) :
+        buffer(new uint8_t[capacity]), capacity_(capacity), first(0), last(0)
+    {}
+
+    explicit RecvBuffer(BufferArena& arena) :
+        buffer(arena.alloc(), Release(&arena)),
+        capacity_(buffer ? arena.bufferSize() : 0), first(0), last(0)
+    {}
+
+    RecvBuffer(RecvBuffer&&) = default;
+    RecvBuffer& operator=(RecvBuffer&&) = default;
+
+    RecvBuffer(const RecvBuffer&) = delete;
+    RecvBuffer& operator=(const RecvBuffer&) = delete;
+
+    explicit operator bool() const { return buffer.get(); }
+
+    size_t capacity() const { return capacity_; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+
+    const uint8_t* begin() const { return buffer.get() + first; }
+    const uint8_t* end() const { return buffer.get() + last; }
+
+    uint8_t* tail() { return buffer.get() + last; }
+    size_t available() const { return capacity_ - last; }
+
+    void commit(size_t bytes)
+    {
+        assert(last + bytes <= capacity_);
+        last += bytes;
+    }
+
+    void consume(size_t bytes)
+    {
+        assert(first + bytes <= last);
+        first += bytes;
+
+        // Cheap reset which avoids having to compact the buffer at all when we
+        // manage to parse everything we've read.
+        if (first == last) first = last = 0;
+    }
+
+    /** Makes sure that a frame of the given size that starts at begin() can be
+        stored in the buffer in its entirety by compacting it if needed. The
+        buffer never grows: frames larger than its capacity must be received
+        elsewhere.
+     */
+    void reserve(size_t frameSize)
+    {
+        assert(frameSize <= capacity_);
+        if (first + frameSize <= capacity_) return;
+
+        compact();
+    }
+
+    void compact()
+    {
+        if (!first) return;
+
+        std::copy(begin(), end(), buffer.get());
+        last -= first;
+        first = 0;
+    }
+
+private:
+
+    struct Release
+    {
+        Release() : arena(nullptr) {}
+        explicit Release(BufferArena* arena) : arena(arena) {}
+
+        void operator() (uint8_t* ptr) const
+        {
+            if (arena) arena->free(ptr);
+            else delete[] ptr;
+        }
+
+        BufferArena* arena;
+    };
+
+    typedef std::unique_ptr<uint8_t[], Release> Buffer;
+
+    Buffer buffer;
+    size_t capacity_;
+    size_t first;
+    size_t last;
+};
+
+} // slick
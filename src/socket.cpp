@@ -12,6 +12,7 @@
 #include <string>
 #include <cstring>
 #include <cassert>
+#include <utility>
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -84,8 +85,8 @@ operator=(Socket&& other) noexcept
 {
     if (this == &other) return *this;
 
-    fd_ = other.fd_;
-    other.fd_ = -1;
+    // Our old fd gets closed along with other instead of being leaked.
+    std::swap(fd_, other.fd_);
 
     return *this;
 }
@@ -148,6 +149,18 @@ accept(int fd)
     return std::move(socket);
 }
 
+Socket
+Socket::
+adopt(int fd)
+{
+    assert(fd >= 0);
+
+    Socket socket;
+    socket.fd_ = fd;
+    socket.init();
+    return std::move(socket);
+}
+
 void
 Socket::
 init()
@@ -194,7 +207,7 @@ throwError() const
 /******************************************************************************/
 
 PassiveSockets::
-PassiveSockets(Port port)
+PassiveSockets(Port port, bool reusePort)
 {
     for (InterfaceIt it(nullptr, port); it; it++) {
 
@@ -204,6 +217,12 @@ PassiveSockets(Port port)
 
         FdGuard guard(fd);
 
+        if (reusePort) {
+            int val = true;
+            int ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof val);
+            SLICK_CHECK_ERRNO(!ret, "PassiveSockets.setsockopt.SO_REUSEPORT");
+        }
+
         int ret = bind(fd, it->ai_addr, it->ai_addrlen);
         if (ret < 0) continue;
 
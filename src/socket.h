@@ -62,6 +62,9 @@ struct Socket
     static Socket connect(const NodeAddress& node);
     static Socket accept(int passiveFd);
 
+    /** Takes ownership of a socket that was accepted by other means. */
+    static Socket adopt(int fd);
+
 private:
     void init();
 
@@ -73,10 +76,14 @@ private:
 /* PASSIVE SOCKETS                                                            */
 /******************************************************************************/
 
+/** When reusePort is set, multiple sets of passive sockets can be bound to the
+    same port and the kernel will load balance incoming connections between
+    them.
+ */
 struct PassiveSockets
 {
     PassiveSockets() {}
-    explicit PassiveSockets(Port port);
+    explicit PassiveSockets(Port port, bool reusePort = false);
     ~PassiveSockets();
 
     PassiveSockets(const PassiveSockets&) = delete;
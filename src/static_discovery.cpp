@@ -53,7 +53,7 @@ StaticDiscovery(std::vector<Address> peers, Port port) :
     timer(period_),
     peers(std::move(peers))
 {
-    endpoint.onPayload = bind(&StaticDiscovery::onPayload, this, _1, _2);
+    endpoint.onPayloadView = bind(&StaticDiscovery::onPayload, this, _1, _2, _3);
     endpoint.onNewConnection = bind(&StaticDiscovery::onConnect, this, _1);
     endpoint.onLostConnection = bind(&StaticDiscovery::onDisconnect, this, _1);
     poller.add(endpoint);
@@ -115,15 +115,13 @@ shutdown()
 
 void
 StaticDiscovery::
-onPayload(int fd, const Payload& data)
+onPayload(int fd, ConstPackIt it, ConstPackIt last)
 {
     auto connIt = connections.find(fd);
     assert(connIt != connections.end());
     auto& conn = connIt->second;
 
 
-    auto it = data.cbegin(), last = data.cend();
-
     if (!conn.initialized()) it = onInit(conn, it, last);
 
     while (it != last) {
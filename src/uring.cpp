@@ -0,0 +1,248 @@
+/* uring.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 18 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   io_uring wrapper implementation.
+*/
+
+#include "uring.h"
+#include "socket.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* SYSCALLS                                                                   */
+/******************************************************************************/
+
+namespace {
+
+int uringSetup(unsigned entries, struct io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(
+            __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+bool kernelAtLeast(unsigned major, unsigned minor)
+{
+    struct utsname name;
+    if (uname(&name) < 0) return false;
+
+    unsigned kMajor = 0, kMinor = 0;
+    if (sscanf(name.release, "%u.%u", &kMajor, &kMinor) != 2) return false;
+
+    return kMajor > major || (kMajor == major && kMinor >= minor);
+}
+
+template<typename T>
+T* offset(void* ptr, size_t off)
+{
+    return reinterpret_cast<T*>(static_cast<uint8_t*>(ptr) + off);
+}
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* URING                                                                      */
+/******************************************************************************/
+
+Uring::
+Uring() :
+    fd_(-1),
+    sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+    ringPtr(MAP_FAILED), ringSize(0), sqesSize(0),
+    buffers(static_cast<uint8_t*>(MAP_FAILED)), buffersSize(0)
+{}
+
+Uring::
+~Uring()
+{
+    if (fd_ >= 0) close(fd_);
+
+    if (buffers != MAP_FAILED) munmap(buffers, buffersSize);
+    if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+    if (ringPtr != MAP_FAILED) munmap(ringPtr, ringSize);
+}
+
+bool
+Uring::
+init(unsigned entries, unsigned numBuffers, unsigned bufferSize)
+{
+    assert(fd_ < 0);
+    assert(numBuffers && numBuffers <= (1 << 15));
+
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof params);
+
+    // Multishot ops can produce a lot of completions per submission.
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    int fd = uringSetup(entries, &params);
+    if (fd < 0) return false;
+
+    FdGuard guard(fd);
+
+    // NODROP guarantees that overflowing the CQ doesn't lose completions.
+    enum { Features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP };
+    if ((params.features & Features) != Features) return false;
+
+    // Multishot receives are only available from 6.0 onwards and there's no
+    // feature bit or probe that can tell us about them.
+    if (!kernelAtLeast(6, 0)) return false;
+
+
+    // Rings
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    ringSize = std::max(sqSize, cqSize);
+
+    ringPtr = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    SLICK_CHECK_ERRNO(ringPtr != MAP_FAILED, "Uring.mmap.ring");
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqesPtr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    SLICK_CHECK_ERRNO(sqesPtr != MAP_FAILED, "Uring.mmap.sqes");
+    sqes = static_cast<struct io_uring_sqe*>(sqesPtr);
+
+    sqHead  = offset<unsigned>(ringPtr, params.sq_off.head);
+    sqTail  = offset<unsigned>(ringPtr, params.sq_off.tail);
+    sqFlags = offset<unsigned>(ringPtr, params.sq_off.flags);
+    sqArray = offset<unsigned>(ringPtr, params.sq_off.array);
+    sqMask  = *offset<unsigned>(ringPtr, params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = sqSubmitted = *sqTail;
+
+    cqHead = offset<unsigned>(ringPtr, params.cq_off.head);
+    cqTail = offset<unsigned>(ringPtr, params.cq_off.tail);
+    cqMask = *offset<unsigned>(ringPtr, params.cq_off.ring_mask);
+    cqes   = offset<struct io_uring_cqe>(ringPtr, params.cq_off.cqes);
+
+
+    // Provided buffers
+
+    fd_ = guard.release();
+
+    bufferSize_ = bufferSize;
+    buffersSize = size_t(numBuffers) * bufferSize;
+    void* buffersPtr = mmap(nullptr, buffersSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    SLICK_CHECK_ERRNO(buffersPtr != MAP_FAILED, "Uring.mmap.buffers");
+    buffers = static_cast<uint8_t*>(buffersPtr);
+
+    struct io_uring_sqe* entry = sqe();
+    provide(entry, 0, numBuffers);
+    entry->user_data = ProvideOp;
+    submit(1);
+
+    // Nothing else is in flight so this has to be our completion.
+    bool provided = false;
+    reap([&] (const struct io_uring_cqe& cqe) {
+                if (cqe.user_data == ProvideOp) provided = cqe.res >= 0;
+            });
+    if (provided) return true;
+
+    close(fd_);
+    fd_ = -1;
+    return false;
+}
+
+
+struct io_uring_sqe*
+Uring::
+sqe()
+{
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries)
+        submit();
+
+    unsigned index = sqLocalTail & sqMask;
+    sqArray[index] = index;
+    sqLocalTail++;
+
+    struct io_uring_sqe* entry = &sqes[index];
+    std::memset(entry, 0, sizeof *entry);
+    return entry;
+}
+
+void
+Uring::
+submit(unsigned waitFor)
+{
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+    unsigned toSubmit = sqLocalTail - sqSubmitted;
+
+    unsigned flags = 0;
+    unsigned sqState = __atomic_load_n(sqFlags, __ATOMIC_ACQUIRE);
+    if (waitFor || (sqState & IORING_SQ_CQ_OVERFLOW))
+        flags |= IORING_ENTER_GETEVENTS;
+
+    if (!toSubmit && !flags) return;
+
+    while (true) {
+        int ret = uringEnter(fd_, toSubmit, waitFor, flags);
+
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+
+            // The kernel is out of memory for completions; the caller has to
+            // reap before we can go any further.
+            if (errno == EBUSY || errno == EAGAIN) return;
+            SLICK_CHECK_ERRNO(ret >= 0, "Uring.enter");
+        }
+
+        sqSubmitted += ret;
+        if (!ret || unsigned(ret) >= toSubmit) return;
+        toSubmit -= ret;
+    }
+}
+
+
+/** Buffers are handed back with PROVIDE_BUFFERS instead of a registered buffer
+    ring which, while cheaper, isn't reliably available on every kernel that
+    supports multishot receives.
+ */
+void
+Uring::
+provide(struct io_uring_sqe* entry, uint16_t id, unsigned count)
+{
+    entry->opcode = IORING_OP_PROVIDE_BUFFERS;
+    entry->fd = count;
+    entry->addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry->len = bufferSize_;
+    entry->off = id;
+    entry->buf_group = BufferGroup;
+}
+
+void
+Uring::
+recycle(uint16_t id)
+{
+    struct io_uring_sqe* entry = sqe();
+    provide(entry, id, 1);
+
+    // Failures would require a completion to be reaped which is useless to us.
+    entry->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+} // slick
@@ -0,0 +1,126 @@
+/* uring.h                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 18 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Minimal io_uring wrapper.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+namespace slick {
+
+
+/******************************************************************************/
+/* URING                                                                      */
+/******************************************************************************/
+
+/** Thin wrapper around the raw io_uring syscalls which comes with a single
+    group of provided buffers for multishot receives.
+
+    Not thread-safe: the submission and completion queues are meant to be
+    owned by a single polling thread. The fd becomes readable whenever there
+    are completions waiting to be reaped so the ring can be slotted into an
+    existing epoll set.
+ */
+struct Uring
+{
+    enum { BufferGroup = 0 };
+
+    /** user_data of the completions that belong to the ring itself. */
+    enum { ProvideOp = 0 };
+
+    Uring();
+    ~Uring();
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    /** Returns false if the kernel lacks any of the features we rely on in
+        which case the object is left uninitialized.
+     */
+    bool init(unsigned entries, unsigned buffers, unsigned bufferSize);
+
+    explicit operator bool() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+
+    /** Returns a zeroed SQE which will be handed to the kernel on the next call
+        to submit. Submits the pending SQEs if the queue is full.
+     */
+    struct io_uring_sqe* sqe();
+
+    void submit(unsigned waitFor = 0);
+
+    /** Calls fn on all the available completions. fn is free to queue new
+        SQEs or submit.
+     */
+    template<typename Fn>
+    void reap(const Fn& fn);
+
+    const uint8_t* buffer(uint16_t id) const
+    {
+        return buffers + size_t(id) * bufferSize_;
+    }
+
+    /** Hands a provided buffer back to the kernel. */
+    void recycle(uint16_t id);
+
+private:
+
+    void provide(struct io_uring_sqe* entry, uint16_t id, unsigned count);
+
+    int fd_;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqFlags;
+    unsigned* sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;
+    unsigned sqSubmitted;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* ringPtr;
+    size_t ringSize;
+    size_t sqesSize;
+
+    uint8_t* buffers;
+    size_t buffersSize;
+    size_t bufferSize_;
+};
+
+
+template<typename Fn>
+void
+Uring::
+reap(const Fn& fn)
+{
+    while (true) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head) {
+            // Copied because the slot is up for grabs once the head moves.
+            struct io_uring_cqe cqe = cqes[head & cqMask];
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            fn(cqe);
+        }
+
+        // Completions that didn't fit in the CQ are kept by the kernel until
+        // we ask for them.
+        unsigned flags = __atomic_load_n(sqFlags, __ATOMIC_ACQUIRE);
+        if (!(flags & IORING_SQ_CQ_OVERFLOW)) return;
+        submit();
+    }
+}
+
+} // slick
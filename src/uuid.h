@@ -81,6 +81,8 @@ locklessStaticAssert(sizeof(UUID) == 16);
 template<>
 struct Pack<UUID>
 {
+    enum { FixedSize = sizeof(UUID) };
+
     static size_t size(const UUID&)
     {
         return sizeof(UUID);
@@ -95,15 +97,13 @@ struct Pack<UUID>
                 value.node[3], value.node[4], value.node[5]);
     }
 
-    static UUID unpack(ConstPackIt first, ConstPackIt last)
+    static ConstPackIt unpack(UUID& value, ConstPackIt first, ConstPackIt last)
     {
-        UUID value;
-        unpackAll(first, last,
+        return unpackAll(first, last,
                 value.time_low, value.time_mid, value.time_hi_and_version,
                 value.clock_seq,
                 value.node[0], value.node[1], value.node[2],
                 value.node[3], value.node[4], value.node[5]);
-        return std::move(value);
     }
 };
 
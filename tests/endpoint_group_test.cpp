@@ -0,0 +1,286 @@
+/* endpoint_group_test.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 16 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Tests for the sharded endpoint group.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "endpoint_group.h"
+#include "pack.h"
+#include "utils.h"
+#include "test_utils.h"
+#include "lockless/format.h"
+
+#include <boost/test/unit_test.hpp>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace slick;
+using namespace lockless;
+
+namespace { Port portCounter = 21000; }
+
+
+/******************************************************************************/
+/* ECHO                                                                       */
+/******************************************************************************/
+
+BOOST_AUTO_TEST_CASE(echo)
+{
+    cerr << fmtTitle("echo", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Shards = 4, Clients = 16, Msgs = 100 };
+
+    EndpointGroup provider(Shards, listenPort);
+
+    std::atomic<size_t> conns(0);
+    provider.onNewConnection = [&] (ConnId) { conns++; };
+    provider.onLostConnection = [&] (ConnId) { conns--; };
+
+    provider.onPayload = [&] (ConnId conn, Payload&& data) {
+        provider.send(conn, std::move(data));
+    };
+
+    provider.onDroppedPayload = [] (ConnId, Payload&&) {
+        assert(false);
+    };
+
+    provider.run();
+
+
+    EndpointGroup client(Shards);
+
+    std::atomic<size_t> recv(0), sum(0);
+    client.onPayload = [&] (ConnId, Payload&& data) {
+        sum += unpack<size_t>(data);
+        recv++;
+    };
+
+    client.onDroppedPayload = [] (ConnId, Payload&&) {
+        assert(false);
+    };
+
+    client.run();
+
+    std::vector<ConnId> ids;
+    for (size_t i = 0; i < Clients; ++i)
+        ids.push_back(client.connect(Address("localhost", listenPort)));
+
+    while (conns != Clients);
+
+    size_t exp = 0;
+    for (size_t i = 0; i < Msgs; ++i) {
+        client.send(ids[i % Clients], pack<size_t>(i));
+        exp += i;
+    }
+
+    client.broadcast(pack<size_t>(1));
+    client.multicast(SortedVector<ConnId>(ids.begin(), ids.end()), pack<size_t>(1));
+    exp += Clients * 2;
+
+    while (recv != Msgs + Clients * 2);
+    BOOST_CHECK_EQUAL(sum, exp);
+
+    for (ConnId id : ids) client.disconnect(id);
+    while (conns);
+
+    client.join();
+    provider.join();
+}
+
+
+/******************************************************************************/
+/* LOST CONNECTIONS                                                           */
+/******************************************************************************/
+
+/** Connections of every round are torn down from both sides, partly through
+    a shard that doesn't own them, and the fds are then reused by the next
+    round. Every connection must be reported lost exactly once and sends to
+    the stale handles must be dropped even when their fd now belongs to
+    another connection, possibly on another shard.
+ */
+BOOST_AUTO_TEST_CASE(lost_connections)
+{
+    cerr << fmtTitle("lost_connections", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Shards = 4, Clients = 16, Rounds = 4 };
+    enum { Stale = 0, Kill = 1 };
+
+    struct Counts
+    {
+        Counts() : total(0), lost(0) {}
+
+        void onNew(ConnId id)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            news[id]++;
+            ids.push_back(id);
+            total++;
+        }
+
+        void onLost(ConnId id)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            losts[id]++;
+            lost++;
+        }
+
+        std::vector<ConnId> round(size_t first)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return std::vector<ConnId>(ids.begin() + first, ids.end());
+        }
+
+        void check()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            BOOST_CHECK_EQUAL(news.size(), size_t(Clients * Rounds));
+            BOOST_CHECK_EQUAL(losts.size(), news.size());
+
+            for (const auto& entry : news) {
+                BOOST_CHECK_EQUAL(entry.second, 1);
+                BOOST_CHECK_EQUAL(losts[entry.first], 1);
+            }
+        }
+
+        std::mutex lock;
+        std::map<ConnId, size_t> news;
+        std::map<ConnId, size_t> losts;
+        std::vector<ConnId> ids;
+        std::atomic<size_t> total;
+        std::atomic<size_t> lost;
+    };
+
+    Counts prvCounts, cltCounts;
+    std::atomic<size_t> prvDropped(0), cltDropped(0), staleRecv(0);
+    std::atomic<size_t> roundFirst(0);
+
+    EndpointGroup provider(Shards, listenPort);
+    provider.onNewConnection = [&] (ConnId id) { prvCounts.onNew(id); };
+    provider.onLostConnection = [&] (ConnId id) { prvCounts.onLost(id); };
+    provider.onDroppedPayload = [&] (ConnId, Payload&&) { prvDropped++; };
+
+    // Runs on the shard which owns the control connection and disconnects
+    // every connection of the round which mostly belong to other shards.
+    provider.onPayload = [&] (ConnId conn, Payload&& data) {
+        if (unpack<size_t>(data) != Kill) { staleRecv++; return; }
+
+        for (ConnId id : prvCounts.round(roundFirst))
+            if (id != conn) provider.disconnect(id);
+        provider.disconnect(conn);
+    };
+
+    provider.run();
+
+
+    EndpointGroup client(Shards);
+    client.onNewConnection = [&] (ConnId id) { cltCounts.onNew(id); };
+    client.onLostConnection = [&] (ConnId id) { cltCounts.onLost(id); };
+    client.onDroppedPayload = [&] (ConnId, Payload&&) { cltDropped++; };
+    client.onPayload = [&] (ConnId, Payload&&) { staleRecv++; };
+    client.run();
+
+    std::vector<ConnId> stalePrv, staleClt;
+    size_t expDropped = 0, reusedFds = 0;
+
+    for (size_t round = 0; round < Rounds; ++round) {
+        size_t total = (round + 1) * Clients;
+        roundFirst = round * Clients;
+
+        std::vector<ConnId> ids;
+        for (size_t i = 0; i < Clients; ++i)
+            ids.push_back(client.connect(Address("localhost", listenPort)));
+
+        while (prvCounts.total != total || cltCounts.total != total);
+
+        // Stale handles of the previous rounds, some of which now share their
+        // fd with a live connection of this round.
+        for (ConnId id : stalePrv) provider.send(id, pack<size_t>(Stale));
+        for (ConnId id : staleClt) client.send(id, pack<size_t>(Stale));
+        expDropped += stalePrv.size();
+
+        for (ConnId id : prvCounts.round(roundFirst))
+            for (ConnId stale : stalePrv)
+                if (connFd(stale) == connFd(id)) reusedFds++;
+
+        // Half are closed by the client while the provider closes the rest
+        // along with the ones that are already going away.
+        for (size_t i = 0; i < Clients / 2; ++i) client.disconnect(ids[i]);
+        client.send(ids.back(), pack<size_t>(Kill));
+
+        while (prvCounts.lost != total || cltCounts.lost != total);
+
+        for (ConnId id : prvCounts.round(roundFirst)) stalePrv.push_back(id);
+        for (ConnId id : ids) staleClt.push_back(id);
+    }
+
+    while (prvDropped != expDropped || cltDropped != expDropped);
+
+    client.join();
+    provider.join();
+
+    BOOST_CHECK_GT(reusedFds, 0);
+    BOOST_CHECK_EQUAL(staleRecv, 0);
+    prvCounts.check();
+    cltCounts.check();
+}
+
+
+/******************************************************************************/
+/* REUSE RACE                                                                 */
+/******************************************************************************/
+
+/** Connections are cancelled as soon as they're created which has the shards
+    closing fds while new connections are grabbing them for other shards.
+    Losses must still be reported exactly once for every handle.
+ */
+BOOST_AUTO_TEST_CASE(reuse_race)
+{
+    cerr << fmtTitle("reuse_race", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Shards = 4, Conns = 2000 };
+
+    std::mutex lock;
+    std::map<ConnId, size_t> losts;
+    std::atomic<size_t> lost(0);
+
+    EndpointGroup provider(Shards, listenPort);
+    provider.run();
+
+    EndpointGroup client(Shards);
+    client.onLostConnection = [&] (ConnId id) {
+        std::lock_guard<std::mutex> guard(lock);
+        losts[id]++;
+        lost++;
+    };
+    client.run();
+
+    std::vector<ConnId> ids;
+    for (size_t i = 0; i < Conns; ++i) {
+        ConnId id = client.connect(Address("localhost", listenPort));
+        if (!id) continue;
+
+        ids.push_back(id);
+        client.disconnect(id);
+    }
+
+    double deadline = wall() + 10;
+    while (lost < ids.size() && wall() < deadline);
+
+    client.join();
+    provider.join();
+
+    BOOST_CHECK_EQUAL(lost, ids.size());
+    for (ConnId id : ids) BOOST_CHECK_EQUAL(losts[id], 1);
+}
@@ -59,16 +59,16 @@ BOOST_AUTO_TEST_CASE(basics)
     Endpoint provider(listenPort);
     poller.add(provider);
 
-    provider.onNewConnection = [] (int fd) {
-        printf("prv: new %d\n", fd);
+    provider.onNewConnection = [] (ConnId conn) {
+        printf("prv: new %d\n", connFd(conn));
     };
-    provider.onLostConnection = [] (int fd) {
-        printf("prv: lost %d\n", fd);
+    provider.onLostConnection = [] (ConnId conn) {
+        printf("prv: lost %d\n", connFd(conn));
     };
 
-    provider.onPayload = [&] (int fd, Payload&& data) {
+    provider.onPayload = [&] (ConnId conn, Payload&& data) {
         auto msg = unpack<std::string>(data);
-        printf("prv: got(%d) %s\n", fd, msg.c_str());
+        printf("prv: got(%d) %s\n", connFd(conn), msg.c_str());
         provider.broadcast(pack("PONG"));
         pingRecv++;
     };
@@ -76,16 +76,16 @@ BOOST_AUTO_TEST_CASE(basics)
     Endpoint client;
     poller.add(client);
 
-    client.onNewConnection = [] (int fd) {
-        printf("cli: new %d\n", fd);
+    client.onNewConnection = [] (ConnId conn) {
+        printf("cli: new %d\n", connFd(conn));
     };
-    client.onLostConnection = [] (int fd) {
-        printf("cli: lost %d\n", fd);
+    client.onLostConnection = [] (ConnId conn) {
+        printf("cli: lost %d\n", connFd(conn));
     };
 
-    client.onPayload = [&] (int fd, Payload&& data) {
+    client.onPayload = [&] (ConnId conn, Payload&& data) {
         auto msg = unpack<std::string>(data);
-        printf("cli: got(%d) %s\n", fd, msg.c_str());
+        printf("cli: got(%d) %s\n", connFd(conn), msg.c_str());
         pongRecv++;
     };
 
@@ -108,6 +108,713 @@ BOOST_AUTO_TEST_CASE(basics)
     BOOST_CHECK_EQUAL(Pings, pongRecv);
 }
 
+BOOST_AUTO_TEST_CASE(payload_view)
+{
+    cerr << fmtTitle("payload_view", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Pings = 32 };
+    std::atomic<size_t> pingRecv(0);
+    std::vector<Payload> kept;
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    poller.add(provider);
+
+    provider.onPayload = [&] (ConnId, Payload&&) {
+        BOOST_CHECK(false);
+    };
+
+    provider.onPayloadView = [&] (ConnId, ConstPackIt first, ConstPackIt last) {
+        size_t ping = unpack<size_t>(first, last);
+        BOOST_CHECK_EQUAL(ping, pingRecv);
+
+        if (ping % 2) kept.emplace_back(first, last);
+        pingRecv++;
+    };
+
+    Endpoint client;
+    poller.add(client);
+
+    std::atomic<bool> connected(false);
+    client.onNewConnection = [&] (ConnId) { connected = true; };
+
+    Connection conn(client, { "localhost", listenPort });
+
+    poller.run();
+    while (!connected);
+
+    for (size_t i = 0; i < Pings; ++i)
+        client.broadcast(pack(i));
+
+    while (pingRecv != Pings);
+    poller.join();
+
+    BOOST_CHECK_EQUAL(kept.size(), Pings / 2);
+    for (size_t i = 0; i < kept.size(); ++i)
+        BOOST_CHECK_EQUAL(unpack<size_t>(kept[i]), i * 2 + 1);
+}
+
+BOOST_AUTO_TEST_CASE(small_recv_buffer)
+{
+    cerr << fmtTitle("small_recv_buffer", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Msgs = 1024, BufferSize = 64 };
+    std::atomic<size_t> recv(0), bytes(0);
+    std::atomic<size_t> dropped(0), droppedBytes(0);
+    std::atomic<bool> connected(false);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    provider.recvBufferSize(BufferSize);
+    poller.add(provider);
+
+    provider.onPayload = [&] (ConnId, Payload&& data) {
+        auto msg = unpack<std::string>(data);
+        BOOST_CHECK_EQUAL(msg, std::string(msg.size(), 'a' + msg.size() % 26));
+
+        bytes += msg.size();
+        recv++;
+    };
+
+    Endpoint client;
+    poller.add(client);
+
+    client.onNewConnection = [&] (ConnId) { connected = true; };
+    client.onDroppedPayload = [&] (ConnId, Payload&& data) {
+        droppedBytes += unpack<std::string>(data).size();
+        dropped++;
+    };
+
+    Connection conn(client, { "localhost", listenPort });
+
+    poller.run();
+    while (!connected);
+
+    // Sizes are picked to straddle the buffer size so that we exercise both
+    // the compaction of the buffer and the reads that bypass it.
+    size_t exp = 0;
+    for (size_t i = 0; i < Msgs; ++i) {
+        size_t size = (i * 7) % (BufferSize * 3);
+        exp += size;
+        client.broadcast(pack(std::string(size, 'a' + size % 26)));
+    }
+
+    while (recv + dropped != Msgs);
+    poller.join();
+
+    BOOST_CHECK_EQUAL(bytes + droppedBytes, exp);
+}
+
+BOOST_AUTO_TEST_CASE(large_frames)
+{
+    cerr << fmtTitle("large_frames", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Msgs = 16, MaxFrameSize = 1 << 24 };
+    std::atomic<size_t> recv(0), dropped(0);
+    std::atomic<bool> connected(false);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    provider.maxFrameSize(MaxFrameSize);
+    poller.add(provider);
+
+    provider.onPayload = [&] (ConnId, Payload&& data) {
+        auto msg = unpack< std::vector<uint32_t> >(data);
+        for (size_t i = 0; i < msg.size(); ++i)
+            BOOST_CHECK_EQUAL(msg[i], i);
+        recv++;
+    };
+
+    Endpoint client;
+    client.maxFrameSize(MaxFrameSize);
+    poller.add(client);
+
+    client.onNewConnection = [&] (ConnId) { connected = true; };
+    client.onDroppedPayload = [&] (ConnId, Payload&&) { dropped++; };
+
+    Connection conn(client, { "localhost", listenPort });
+
+    poller.run();
+    while (!connected);
+
+    for (size_t i = 0; i < Msgs; ++i) {
+        std::vector<uint32_t> msg((i + 1) * (1 << 16));
+        for (size_t j = 0; j < msg.size(); ++j) msg[j] = j;
+        client.broadcast(pack(msg));
+    }
+
+    // Over the limit so it never makes it on the wire.
+    client.broadcast(pack(std::string(MaxFrameSize + 1, 'a')));
+
+    while (recv + dropped != Msgs + 1);
+    poller.join();
+
+    BOOST_CHECK_EQUAL(dropped, 1);
+    BOOST_CHECK_EQUAL(recv, Msgs);
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_arena)
+{
+    cerr << fmtTitle("recv_buffer_arena", '=') << endl;
+
+    enum { Conns = 4, Buffers = 2, BufferSize = 1 << 12 };
+
+    for (auto policy : { BufferArena::Grow, BufferArena::Drop }) {
+        const Port listenPort = portCounter++;
+
+        std::atomic<size_t> conns(0), recv(0), lost(0);
+
+        PollThread poller;
+
+        // Huge pages would round the arena up to a lot more buffers.
+        Endpoint provider(listenPort);
+        provider.recvBufferSize(BufferSize);
+        provider.recvBufferArena(Buffers, BufferArena::Lock, policy);
+        poller.add(provider);
+
+        provider.onPayload = [&] (ConnId, Payload&& data) {
+            BOOST_CHECK_EQUAL(unpack<std::string>(data), "bleh");
+            recv++;
+        };
+
+        Endpoint client;
+        poller.add(client);
+
+        client.onNewConnection = [&] (ConnId) { conns++; };
+        client.onLostConnection = [&] (ConnId) { lost++; };
+
+        poller.run();
+
+        std::vector<ConnId> ids;
+        for (size_t i = 0; i < Conns; ++i)
+            ids.push_back(client.connect({ "localhost", listenPort }));
+        while (conns != Conns);
+
+        for (ConnId id : ids) client.send(id, pack(std::string("bleh")));
+
+        while (recv + lost != Conns);
+        poller.join();
+
+        const auto& stats = provider.recvBufferArenaStats();
+        printf("policy=%d, recv=%lu, lost=%lu, capacity=%lu, peak=%lu, "
+                "regions=%lu, exhausted=%lu, locked=%d\n",
+                policy, size_t(recv), size_t(lost), stats.capacity,
+                stats.peak, stats.regions, stats.exhausted, stats.locked);
+
+        BOOST_CHECK_EQUAL(stats.bufferSize, BufferSize);
+        BOOST_CHECK_EQUAL(stats.used, recv);
+        BOOST_CHECK_GT(stats.exhausted, 0);
+
+        if (policy == BufferArena::Grow) {
+            BOOST_CHECK_EQUAL(recv, Conns);
+            BOOST_CHECK_EQUAL(stats.regions, 2);
+            BOOST_CHECK_EQUAL(stats.peak, Conns);
+        }
+        else {
+            BOOST_CHECK_EQUAL(recv, Buffers);
+            BOOST_CHECK_EQUAL(lost, Conns - Buffers);
+            BOOST_CHECK_EQUAL(stats.regions, 1);
+            BOOST_CHECK_EQUAL(stats.peak, Buffers);
+        }
+
+        for (ConnId id : ids) client.disconnect(id);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cork)
+{
+    cerr << fmtTitle("cork", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Pings = 1024 };
+    std::atomic<size_t> pingRecv(0), dropped(0);
+    std::atomic<bool> connected(false);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    poller.add(provider);
+
+    provider.onPayload = [&] (ConnId, Payload&& data) {
+        BOOST_CHECK_LT(pingRecv, unpack<size_t>(data) + 1);
+        pingRecv++;
+    };
+
+    Endpoint client;
+    client.cork();
+    poller.add(client);
+
+    client.onNewConnection = [&] (ConnId) { connected = true; };
+    client.onDroppedPayload = [&] (ConnId, Payload&&) { dropped++; };
+
+    Connection conn(client, { "localhost", listenPort });
+
+    poller.run();
+    while (!connected);
+
+    for (size_t i = 0; i < Pings; ++i)
+        client.broadcast(pack(i));
+
+    while (pingRecv + dropped != Pings);
+    poller.join();
+
+    const auto& stats = client.stats();
+    BOOST_CHECK_EQUAL(stats.sentPayloads, pingRecv);
+    BOOST_CHECK_LT(stats.sendCalls, stats.sentPayloads);
+}
+
+BOOST_AUTO_TEST_CASE(coalesce)
+{
+    cerr << fmtTitle("coalesce", '=') << endl;
+
+    enum { Msgs = 1 << 12, LargeEvery = 16, LargeSize = 1 << 10 };
+
+    auto makeMsg = [] (size_t i) {
+        Payload data(i % LargeEvery ? sizeof(i) : size_t(LargeSize));
+        *reinterpret_cast<size_t*>(data.begin()) = i;
+        return data;
+    };
+
+    for (size_t deadlineUs : { 0, 1000 }) {
+        const Port listenPort = portCounter++;
+
+        std::atomic<size_t> recv(0), dropped(0);
+        std::atomic<bool> connected(false);
+        size_t last = 0;
+
+        PollThread poller;
+
+        Endpoint provider(listenPort);
+        poller.add(provider);
+
+        provider.onPayload = [&] (ConnId, Payload&& data) {
+            size_t i = *reinterpret_cast<const size_t*>(data.cbegin());
+            BOOST_CHECK_EQUAL(data.size(), makeMsg(i).size());
+            if (recv) BOOST_CHECK_LT(last, i);
+
+            last = i;
+            recv++;
+        };
+
+        Endpoint client;
+        client.coalesce(64, Endpoint::DefaultCoalesceSize, deadlineUs);
+        poller.add(client);
+
+        client.onNewConnection = [&] (ConnId) { connected = true; };
+        client.onDroppedPayload = [&] (ConnId, Payload&&) { dropped++; };
+
+        ConnId conn = client.connect({ "localhost", listenPort });
+
+        poller.run();
+        while (!connected);
+
+        for (size_t i = 0; i < Msgs; ++i) {
+            client.send(conn, makeMsg(i));
+
+            // Avoids overflowing the deferred send queue.
+            while (recv + dropped + 32 < i);
+        }
+
+        while (recv + dropped != Msgs);
+        poller.join();
+
+        const auto& stats = client.stats();
+        printf("deadline=%luus, recv=%lu, dropped=%lu, coalesced=%lu, sends=%lu\n",
+                deadlineUs, size_t(recv), size_t(dropped),
+                stats.coalescedPayloads, stats.sendCalls);
+
+        BOOST_CHECK_GT(stats.coalescedPayloads, 0);
+        BOOST_CHECK_LT(stats.sendCalls, recv);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(payload_chain)
+{
+    cerr << fmtTitle("payload_chain", '=') << endl;
+
+    enum { Msgs = 1 << 10, Bodies = 8 };
+
+    std::vector<Payload> bodies;
+    for (size_t i = 0; i < Bodies; ++i)
+        bodies.push_back(pack(std::string(i * i * 128, 'a' + i)));
+
+    struct Config { Endpoint::IoBackend backend; bool cork; size_t coalesce; };
+    std::vector<Config> configs = {
+        { Endpoint::EpollBackend, false, 0 },
+        { Endpoint::EpollBackend, true, 0 },
+        { Endpoint::EpollBackend, false, 256 },
+        { Endpoint::UringBackend, false, 0 },
+    };
+
+    for (const auto& config : configs) {
+        const Port listenPort = portCounter++;
+
+        std::atomic<size_t> recv(0), dropped(0);
+        std::atomic<bool> connected(false);
+
+        PollThread poller;
+
+        Endpoint provider(listenPort);
+        poller.add(provider);
+
+        provider.onPayload = [&] (ConnId, Payload&& data) {
+            size_t i;
+            Payload body;
+            unpackAll(data, i, body);
+
+            BOOST_CHECK_EQUAL(
+                    unpack<std::string>(body),
+                    unpack<std::string>(bodies[i % Bodies]));
+            recv++;
+        };
+
+        Endpoint client(config.backend);
+        if (client.backend() != config.backend) {
+            cerr << "io_uring not supported; skipping" << endl;
+            continue;
+        }
+
+        client.cork(config.cork);
+        client.coalesce(config.coalesce);
+        poller.add(client);
+
+        client.onNewConnection = [&] (ConnId) { connected = true; };
+        client.onDroppedPayload = [&] (ConnId, Payload&& data) {
+            size_t i;
+            Payload body;
+            unpackAll(data, i, body);
+            BOOST_CHECK_EQUAL(body.size(), bodies[i % Bodies].size());
+            dropped++;
+        };
+
+        ConnId conn = client.connect({ "localhost", listenPort });
+
+        poller.run();
+        while (!connected);
+
+        for (size_t i = 0; i < Msgs; ++i) {
+            client.send(conn, packChain(i, bodies[i % Bodies]));
+
+            // Avoids overflowing the deferred send queue.
+            while (recv + dropped + 32 < i);
+        }
+
+        while (recv + dropped != Msgs);
+        poller.join();
+
+        printf("backend=%d, cork=%d, coalesce=%lu, recv=%lu, dropped=%lu\n",
+                config.backend, config.cork, config.coalesce,
+                size_t(recv), size_t(dropped));
+        BOOST_CHECK_EQUAL(recv, Msgs);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(zero_copy)
+{
+    cerr << fmtTitle("zero_copy", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Msgs = 64, MaxFrameSize = 1 << 22, Threshold = 1 << 16 };
+    std::atomic<size_t> recv(0), dropped(0);
+    std::atomic<bool> connected(false);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    provider.maxFrameSize(MaxFrameSize);
+    poller.add(provider);
+
+    provider.onPayload = [&] (ConnId, Payload&& data) {
+        auto msg = unpack<std::string>(data);
+        BOOST_CHECK(msg == std::string(msg.size(), 'a' + msg.size() % 26));
+        recv++;
+    };
+
+    Endpoint client;
+    client.maxFrameSize(MaxFrameSize);
+    client.zeroCopy(Threshold);
+    poller.add(client);
+
+    client.onNewConnection = [&] (ConnId) { connected = true; };
+    client.onDroppedPayload = [&] (ConnId, Payload&&) { dropped++; };
+
+    ConnId conn = client.connect({ "localhost", listenPort });
+
+    poller.run();
+    while (!connected);
+
+    // Mixes payloads on both sides of the threshold.
+    std::vector<Payload> msgs;
+    for (size_t i = 0; i < Msgs; ++i) {
+        size_t size = (i * 65537) % (MaxFrameSize / 2);
+        msgs.push_back(pack(std::string(size, 'a' + size % 26)));
+    }
+
+    for (size_t i = 0; i < Msgs; ++i) {
+        client.send(conn, msgs[i]);
+
+        // Avoids overflowing the deferred send queue.
+        while (recv + dropped + 8 < i);
+    }
+
+    while (recv + dropped != Msgs);
+    BOOST_CHECK_EQUAL(recv, Msgs);
+
+    // The payloads are only released once the kernel is done with them.
+    double deadline = wall() + 10;
+    auto released = [&] {
+        for (const auto& msg : msgs) if (!msg.unique()) return false;
+        return true;
+    };
+    while (!released() && wall() < deadline);
+    BOOST_CHECK(released());
+
+    // Payloads still held by the kernel outlive the connection and are
+    // released once their completions come in.
+    for (size_t i = 0; i < Msgs; ++i) client.send(conn, msgs[i]);
+    client.disconnect(conn);
+
+    deadline = wall() + 10;
+    while (!released() && wall() < deadline);
+    BOOST_CHECK(released());
+
+    poller.join();
+
+    const auto& stats = client.stats();
+    printf("sends=%lu, zc=%lu, copied=%lu, fallbacks=%lu\n",
+            stats.sendCalls, stats.zeroCopySends, stats.zeroCopyCopied,
+            stats.zeroCopyFallbacks);
+    BOOST_CHECK_GT(stats.zeroCopySends, 0);
+}
+
+BOOST_AUTO_TEST_CASE(busy_poll)
+{
+    cerr << fmtTitle("busy_poll", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Pings = 1024 };
+    std::atomic<size_t> pongRecv(0);
+    std::atomic<bool> connected(false);
+    std::atomic<bool> done(false);
+
+    Endpoint provider(listenPort);
+    provider.busyPoll(1000, true);
+
+    provider.onPayload = [&] (ConnId conn, Payload&& data) {
+        provider.send(conn, std::move(data));
+    };
+
+    // Busy polling is meant to be used without the extra epoll hop of a
+    // PollThread.
+    std::thread providerTh([&] {
+                provider.startPolling();
+                while (!done) provider.poll(10);
+                provider.stopPolling();
+            });
+
+    PollThread poller;
+
+    Endpoint client;
+    poller.add(client);
+
+    client.onNewConnection = [&] (ConnId) { connected = true; };
+    client.onPayload = [&] (ConnId conn, Payload&& data) {
+        size_t i = unpack<size_t>(data);
+        if (++pongRecv < Pings) client.send(conn, pack(i + 1));
+    };
+
+    Connection conn(client, { "localhost", listenPort });
+
+    poller.run();
+    while (!connected);
+
+    client.broadcast(pack<size_t>(0));
+    while (pongRecv != Pings);
+
+    poller.join();
+    done = true;
+    providerTh.join();
+
+    const auto& stats = provider.stats();
+    BOOST_CHECK_GT(stats.productiveSpins, 0);
+    cerr << "spins: empty=" << stats.emptySpins
+        << ", productive=" << stats.productiveSpins << endl;
+}
+
+BOOST_AUTO_TEST_CASE(backpressure)
+{
+    cerr << fmtTitle("backpressure", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum {
+        Payloads = 128,
+        PayloadSize = 1 << 14,
+        LowWatermark = 1 << 16,
+        HighWatermark = 1 << 18,
+        MaxSendQueue = 1 << 20,
+    };
+
+    std::atomic<size_t> sentBytes(0), droppedBytes(0);
+    std::atomic<bool> engaged(false), released(false);
+    std::atomic<bool> connected(false);
+    std::atomic<ConnId> connId(0);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    provider.sendQueueWatermarks(LowWatermark, HighWatermark);
+    provider.maxSendQueue(MaxSendQueue);
+    poller.add(provider);
+
+    provider.onNewConnection = [&] (ConnId conn) {
+        for (size_t i = 0; i < Payloads; ++i) {
+            Payload data = pack(std::string(PayloadSize, 'a'));
+            sentBytes += data.packetSize();
+            provider.send(conn, std::move(data));
+        }
+
+        BOOST_CHECK(engaged);
+        BOOST_CHECK_GE(provider.pendingBytes(conn), size_t(HighWatermark));
+        BOOST_CHECK_LE(provider.pendingBytes(conn), size_t(MaxSendQueue));
+        connId = conn;
+        connected = true;
+    };
+
+    provider.onDroppedPayload = [&] (ConnId, Payload&& data) {
+        droppedBytes += data.packetSize();
+    };
+
+    provider.onBackpressure = [&] (ConnId conn, bool on) {
+        if (on) {
+            BOOST_CHECK(!engaged);
+            BOOST_CHECK_GE(provider.pendingBytes(conn), size_t(HighWatermark));
+            engaged = true;
+        }
+        else {
+            BOOST_CHECK(engaged);
+            BOOST_CHECK_LE(provider.pendingBytes(conn), size_t(LowWatermark));
+            released = true;
+        }
+    };
+
+    poller.run();
+
+    // Raw socket that only reads once the provider has filled up its queue.
+    Socket socket = Socket::connect(Address("localhost", listenPort));
+    while (!connected);
+
+    BOOST_CHECK_GT(droppedBytes, 0);
+
+    std::vector<uint8_t> buffer(1 << 16);
+    size_t recvBytes = 0;
+
+    while (recvBytes < sentBytes - droppedBytes) {
+        ssize_t n = recv(socket.fd(), buffer.data(), buffer.size(), 0);
+        if (n > 0) recvBytes += n;
+        else if (n < 0 && errno != EAGAIN) break;
+    }
+
+    // The queue can also be checked from outside the polling thread although
+    // it might lag a little behind what the socket received.
+    double deadline = wall() + 10;
+    while (provider.pendingBytes(connId) && wall() < deadline);
+    BOOST_CHECK_EQUAL(provider.pendingBytes(connId), 0);
+
+    poller.join();
+
+    BOOST_CHECK_EQUAL(recvBytes, sentBytes - droppedBytes);
+    BOOST_CHECK(released);
+}
+
+BOOST_AUTO_TEST_CASE(uring)
+{
+    cerr << fmtTitle("uring", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Msgs = 256, MaxFrameSize = 1 << 20 };
+    std::atomic<size_t> conns(0), lost(0), recv(0), bytes(0);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort, Endpoint::UringBackend);
+    if (provider.backend() != Endpoint::UringBackend) {
+        cerr << "io_uring not supported; skipping" << endl;
+        return;
+    }
+
+    provider.maxFrameSize(MaxFrameSize);
+    poller.add(provider);
+
+    provider.onNewConnection = [&] (ConnId) { conns++; };
+    provider.onLostConnection = [&] (ConnId) { lost++; };
+    provider.onPayload = [&] (ConnId conn, Payload&& data) {
+        provider.send(conn, std::move(data));
+    };
+
+    // Mixes both backends to make sure that they can talk to each other.
+    Endpoint uringClient(Endpoint::UringBackend);
+    Endpoint epollClient(Endpoint::EpollBackend);
+
+    for (Endpoint* client : { &uringClient, &epollClient }) {
+        client->maxFrameSize(MaxFrameSize);
+        poller.add(*client);
+
+        client->onPayload = [&] (ConnId, Payload&& data) {
+            auto msg = unpack<std::string>(data);
+            BOOST_CHECK_EQUAL(msg, std::string(msg.size(), 'a' + msg.size() % 26));
+
+            bytes += msg.size();
+            recv++;
+        };
+    }
+
+    poller.run();
+
+    ConnId uringConn = uringClient.connect({ "localhost", listenPort });
+    ConnId epollConn = epollClient.connect({ "localhost", listenPort });
+    while (conns != 2);
+
+    // Sizes are picked to straddle the provided buffers, the receive buffer
+    // and the large frame threshold.
+    size_t exp = 0;
+    for (size_t i = 0; i < Msgs; ++i) {
+        size_t size = (i * 997) % (1 << 18);
+        exp += size * 2;
+
+        auto msg = pack(std::string(size, 'a' + size % 26));
+        uringClient.send(uringConn, msg);
+        epollClient.send(epollConn, msg);
+
+        // Avoids overflowing the deferred send queues.
+        while (recv + 32 < i * 2);
+    }
+
+    while (recv != Msgs * 2);
+    BOOST_CHECK_EQUAL(bytes, exp);
+
+    uringClient.disconnect(uringConn);
+    epollClient.disconnect(epollConn);
+    while (lost != 2);
+
+    poller.join();
+
+    BOOST_CHECK_LT(provider.stats().sendCalls, provider.stats().sentPayloads + 1);
+}
+
 BOOST_AUTO_TEST_CASE(n_to_n)
 {
     cerr << fmtTitle("n_to_n", '=') << endl;
@@ -131,14 +838,14 @@ BOOST_AUTO_TEST_CASE(n_to_n)
         provPoller.add(*providers[id]);
 
         weak_ptr<Endpoint> prov(providers[id]);
-        providers[id]->onPayload = [=, &clientIdSums] (int fd, Payload&& data) {
+        providers[id]->onPayload = [=, &clientIdSums] (ConnId conn, Payload&& data) {
             clientIdSums[id] += unpack<size_t>(data);
 
             auto ptr = prov.lock();
-            ptr->send(fd, pack<size_t>(id + 1));
+            ptr->send(conn, pack<size_t>(id + 1));
         };
 
-        providers[id]->onDroppedPayload = [] (int, Payload&&) {
+        providers[id]->onDroppedPayload = [] (ConnId, Payload&&) {
             assert(false);
         };
 
@@ -154,12 +861,12 @@ BOOST_AUTO_TEST_CASE(n_to_n)
     Endpoint client;
     clientPoller.add(client);
 
-    client.onDroppedPayload = [] (int, Payload&&) {
+    client.onDroppedPayload = [] (ConnId, Payload&&) {
         assert(false);
     };
 
     std::atomic<size_t> provIdSum(0);
-    client.onPayload = [&] (int, Payload&& data) {
+    client.onPayload = [&] (ConnId, Payload&& data) {
         provIdSum += unpack<size_t>(data);
     };
 
@@ -205,13 +912,13 @@ BOOST_AUTO_TEST_CASE(nice_disconnect)
     Endpoint provider(listenPort);
     poller.add(provider);
 
-    provider.onNewConnection = [&] (int fd) {
+    provider.onNewConnection = [&] (ConnId conn) {
         gotClient = true;
-        printf("prv: new %d\n", fd);
+        printf("prv: new %d\n", connFd(conn));
     };
-    provider.onLostConnection = [&] (int fd) {
+    provider.onLostConnection = [&] (ConnId conn) {
         lostClient = true;
-        printf("prv: lost %d\n", fd);
+        printf("prv: lost %d\n", connFd(conn));
     };
 
     Endpoint client;
@@ -230,6 +937,91 @@ BOOST_AUTO_TEST_CASE(nice_disconnect)
     poller.join();
 }
 
+BOOST_AUTO_TEST_CASE(stale_handle)
+{
+    cerr << fmtTitle("stale_handle", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    std::atomic<size_t> conns(0), lost(0), recv(0), dropped(0);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    poller.add(provider);
+
+    provider.onNewConnection = [&] (ConnId) { conns++; };
+    provider.onLostConnection = [&] (ConnId) { lost++; };
+    provider.onPayload = [&] (ConnId, Payload&&) { recv++; };
+
+    Endpoint client;
+    poller.add(client);
+
+    client.onDroppedPayload = [&] (ConnId, Payload&&) { dropped++; };
+
+    poller.run();
+
+    ConnId first = client.connect(Address("localhost", listenPort));
+    while (conns != 1);
+
+    client.disconnect(first);
+    while (lost != 1);
+
+    // The kernel hands out the lowest fd so the new connection will most
+    // likely reuse the fd of the old one.
+    ConnId second = client.connect(Address("localhost", listenPort));
+    while (conns != 2);
+
+    BOOST_CHECK_NE(first, second);
+
+    client.send(first, pack<size_t>(1));
+    while (dropped != 1);
+
+    client.send(second, pack<size_t>(2));
+    while (recv != 1);
+
+    poller.join();
+
+    BOOST_CHECK_EQUAL(recv, 1);
+    BOOST_CHECK_EQUAL(dropped, 1);
+}
+
+BOOST_AUTO_TEST_CASE(cancelled_connect)
+{
+    cerr << fmtTitle("cancelled_connect", '=') << endl;
+
+    const Port listenPort = portCounter++;
+
+    enum { Conns = 2000 };
+    std::atomic<size_t> lost(0);
+
+    PollThread poller;
+
+    Endpoint provider(listenPort);
+    poller.add(provider);
+
+    Endpoint client;
+    poller.add(client);
+
+    client.onLostConnection = [&] (ConnId) { lost++; };
+
+    poller.run();
+
+    // Both calls are deferred to the polling thread and the disconnect must
+    // not overtake the connect or it would be ignored.
+    for (size_t i = 0; i < Conns; ++i) {
+        ConnId id = client.connect(Address("localhost", listenPort));
+        client.disconnect(id);
+    }
+
+    double deadline = wall() + 10;
+    while (lost != Conns && wall() < deadline);
+
+    poller.join();
+
+    BOOST_CHECK_EQUAL(lost, Conns);
+}
+
 BOOST_AUTO_TEST_CASE(hard_disconnect)
 {
     cerr << fmtTitle("hard_disconnecct", '=') << endl;
@@ -248,13 +1040,13 @@ BOOST_AUTO_TEST_CASE(hard_disconnect)
         Endpoint provider(listenPort);
         poller.add(provider);
 
-        provider.onNewConnection = [&] (int fd) {
+        provider.onNewConnection = [&] (ConnId conn) {
             gotClient = true;
-            printf("prv: new %d\n", fd);
+            printf("prv: new %d\n", connFd(conn));
         };
-        provider.onLostConnection = [&] (int fd) {
+        provider.onLostConnection = [&] (ConnId conn) {
             lostClient = true;
-            printf("prv: lost %d\n", fd);;
+            printf("prv: lost %d\n", connFd(conn));;
         };
 
         poller.run();
@@ -0,0 +1,358 @@
+/* pack_perf_test.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 23 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Pack framework benchmarks.
+
+   Usage:
+
+       pack_perf_test [ops]
+
+   The discovery runs unpack messages shaped like the ones exchanged by peer
+   discovery. The two-pass runs unpack each item through the value returning
+   form of Pack::unpack which then requires the packed size of the item to find
+   the next one. This is only the outermost layer of what every level of the
+   old unpack used to do so the gap is a lower bound. The view runs scan the
+   same messages through views which doesn't allocate anything.
+
+   The vector runs report the throughput of packing and unpacking vectors of
+   numbers compared to converting each element individually. The vectorized
+   conversions are only used when building with USE_NATIVE_ARCH (or the
+   equivalent -m flags).
+
+   The varint runs compare the wire size and the unpack rate of vectors of
+   small counters packed as is and as compact varints.
+*/
+
+#include "pack.h"
+#include "pack_view.h"
+#include "pack_compact.h"
+#include "uuid.h"
+#include "address.h"
+#include "lockless/format.h"
+
+#include <tuple>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+using namespace slick;
+using namespace lockless;
+
+
+/******************************************************************************/
+/* MESSAGES                                                                   */
+/******************************************************************************/
+
+// Same layout as PeerDiscovery::KeyItem.
+typedef std::tuple<std::string, UUID, NodeAddress, size_t> KeyItem;
+
+// Same layout as Address.
+typedef std::tuple<StringView, Port> AddressView;
+typedef std::tuple<
+    StringView, UUID, PackedVectorView<AddressView>, size_t> KeyItemView;
+
+struct TwoPassItem
+{
+    KeyItem item;
+};
+
+namespace slick {
+
+template<>
+struct Pack<TwoPassItem>
+{
+    static size_t size(const TwoPassItem& value)
+    {
+        return packedSize(value.item);
+    }
+
+    static void pack(const TwoPassItem& value, PackIt first, PackIt last)
+    {
+        slick::pack(value.item, first, last);
+    }
+
+    static TwoPassItem unpack(ConstPackIt first, ConstPackIt last)
+    {
+        TwoPassItem value;
+        slick::unpack(value.item, first, last);
+        return value;
+    }
+};
+
+} // namespace slick
+
+
+KeyItem makeItem(size_t i)
+{
+    NodeAddress node = {
+        Address("10.0.0." + to_string(i % 256), 18888),
+        Address("192.168.1." + to_string(i % 256), 18888),
+        Address("node-" + to_string(i) + ".cluster.local", 18888),
+    };
+
+    return KeyItem("key-" + to_string(i), UUID::random(), std::move(node), i);
+}
+
+
+/******************************************************************************/
+/* DISCOVERY                                                                  */
+/******************************************************************************/
+
+template<typename Item>
+double benchDiscovery(const Payload& data, size_t items, size_t ops)
+{
+    std::vector<Item> value;
+    size_t count = 0;
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < ops; ++i) {
+        auto it = unpack(value, data.cbegin(), data.cend());
+        if (it != data.cend()) abort();
+        count += value.size();
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    if (count != items * ops) abort();
+    return ops / elapsed.count();
+}
+
+double benchDiscoveryView(const Payload& data, size_t items, size_t ops)
+{
+    PackedVectorView<KeyItemView> value;
+    size_t count = 0;
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < ops; ++i) {
+        auto it = unpack(value, data.cbegin(), data.cend());
+        if (it != data.cend()) abort();
+
+        // Touch every field as a handler scanning the message would.
+        for (const auto& item : value) {
+            count += !std::get<0>(item).empty();
+            for (const auto& addr : std::get<2>(item))
+                count += std::get<0>(addr).empty();
+        }
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    if (count != items * ops) abort();
+    return ops / elapsed.count();
+}
+
+void benchDiscovery(size_t ops)
+{
+    fprintf(stderr, "%-8s %-8s %-12s %-12s %-8s %-12s\n",
+            "items", "bytes", "two-pass", "single-pass", "speedup", "view");
+
+    for (size_t items : { 1, 8, 32, 128 }) {
+        std::vector<KeyItem> msg;
+        for (size_t i = 0; i < items; ++i) msg.emplace_back(makeItem(i));
+
+        Payload data = pack(msg);
+        size_t iterOps = std::max<size_t>(ops / items, 1);
+
+        double twoPass = benchDiscovery<TwoPassItem>(data, items, iterOps);
+        double singlePass = benchDiscovery<KeyItem>(data, items, iterOps);
+        double view = benchDiscoveryView(data, items, iterOps);
+
+        fprintf(stderr, "%-8zu %-8s %-12s %-12s %-8s %-12s\n",
+                items, fmtValue(data.size()).c_str(),
+                fmtValue(twoPass).c_str(), fmtValue(singlePass).c_str(),
+                lockless::format("%.2fx", singlePass / twoPass).c_str(),
+                fmtValue(view).c_str());
+    }
+}
+
+
+/******************************************************************************/
+/* VECTORS                                                                    */
+/******************************************************************************/
+
+/** Element by element conversion which is what vectors of numbers used to go
+    through.
+ */
+template<typename T>
+struct ScalarVector
+{
+    static void pack(const std::vector<T>& value, PackIt first, PackIt last)
+    {
+        PackIt it = Payload::writeHeader(first, value.size());
+        for (const auto& item : value) it = slick::pack(item, it, last);
+    }
+
+    static ConstPackIt unpack(
+            std::vector<T>& value, ConstPackIt first, ConstPackIt last)
+    {
+        size_t size;
+        ConstPackIt it = Payload::readHeader(first, last, size);
+        if (!it) abort();
+
+        value.clear();
+        value.reserve(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            T item;
+            it = slick::unpack(item, it, last);
+            value.emplace_back(item);
+        }
+
+        return it;
+    }
+};
+
+template<typename T>
+struct BulkVector
+{
+    static void pack(const std::vector<T>& value, PackIt first, PackIt last)
+    {
+        Pack< std::vector<T> >::pack(value, first, last);
+    }
+
+    static ConstPackIt unpack(
+            std::vector<T>& value, ConstPackIt first, ConstPackIt last)
+    {
+        return Pack< std::vector<T> >::unpack(value, first, last);
+    }
+};
+
+/** Returns the pack and unpack throughput in bytes per second. */
+template<typename Impl, typename T>
+std::pair<double, double> benchVector(const std::vector<T>& value, size_t ops)
+{
+    Payload data(packedSize(value));
+    std::vector<T> result;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; ++i)
+        Impl::pack(value, data.begin(), data.end());
+    chrono::duration<double> packElapsed = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; ++i)
+        Impl::unpack(result, data.cbegin(), data.cend());
+    chrono::duration<double> unpackElapsed = chrono::steady_clock::now() - start;
+
+    if (result != value) abort();
+
+    double bytes = double(value.size() * sizeof(T)) * ops;
+    return std::make_pair(
+            bytes / packElapsed.count(), bytes / unpackElapsed.count());
+}
+
+template<typename T>
+void benchVector(const char* name, size_t ops)
+{
+    for (size_t n : { 1 << 6, 1 << 10, 1 << 14, 1 << 18 }) {
+        std::vector<T> value(n);
+        for (size_t i = 0; i < n; ++i) value[i] = T(i * 7919);
+
+        size_t iterOps = std::max<size_t>(ops * 64 / n, 1);
+
+        auto scalar = benchVector< ScalarVector<T> >(value, iterOps);
+        auto bulk = benchVector< BulkVector<T> >(value, iterOps);
+
+        fprintf(stderr, "%-8s %-8zu %-12.2f %-12.2f %-12.2f %-12.2f\n",
+                name, n,
+                scalar.first / 1e9, bulk.first / 1e9,
+                scalar.second / 1e9, bulk.second / 1e9);
+    }
+}
+
+void benchVectors(size_t ops)
+{
+    fprintf(stderr, "%-8s %-8s %-12s %-12s %-12s %-12s\n",
+            "type", "items",
+            "pack-scalar", "pack-bulk", "unpack-scalar", "unpack-bulk");
+
+    benchVector<uint16_t>("u16", ops);
+    benchVector<uint32_t>("u32", ops);
+    benchVector<uint64_t>("u64", ops);
+    benchVector<double>("double", ops);
+
+    fprintf(stderr, "(GB/s)\n");
+}
+
+
+/******************************************************************************/
+/* VARINTS                                                                    */
+/******************************************************************************/
+
+template<typename T>
+double benchUnpack(const Payload& data, size_t ops)
+{
+    T value;
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < ops; ++i) {
+        auto it = unpack(value, data.cbegin(), data.cend());
+        if (it != data.cend()) abort();
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return ops / elapsed.count();
+}
+
+void benchVarints(size_t ops)
+{
+    enum { Items = 1 << 10 };
+
+    typedef std::vector<uint64_t> FixedT;
+    typedef Compact< std::vector< Compact<uint64_t> > > CompactT;
+
+    fprintf(stderr, "%-8s %-10s %-10s %-12s %-12s\n",
+            "bits", "fixed", "compact", "fixed/s", "compact/s");
+
+    std::mt19937_64 rng;
+
+    for (size_t bits : { 7, 14, 28, 56 }) {
+        std::uniform_int_distribution<uint64_t> dist(0, (1ULL << bits) - 1);
+
+        FixedT fixed;
+        std::vector< Compact<uint64_t> > compacted;
+        for (size_t i = 0; i < Items; ++i) {
+            fixed.push_back(dist(rng));
+            compacted.push_back(fixed.back());
+        }
+
+        Payload fixedData = pack(fixed);
+        Payload compactData = pack(compact(compacted));
+        size_t iterOps = std::max<size_t>(ops / Items * 64, 1);
+
+        double fixedRate = benchUnpack<FixedT>(fixedData, iterOps) * Items;
+        double compactRate = benchUnpack<CompactT>(compactData, iterOps) * Items;
+
+        fprintf(stderr, "%-8zu %-10s %-10s %-12s %-12s\n",
+                bits,
+                fmtValue(fixedData.size()).c_str(),
+                fmtValue(compactData.size()).c_str(),
+                fmtValue(fixedRate).c_str(), fmtValue(compactRate).c_str());
+    }
+}
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char** argv)
+{
+    size_t ops = 100000;
+    if (argc > 1) ops = stoull(string(argv[1]));
+
+    benchDiscovery(ops);
+    fprintf(stderr, "\n");
+    benchVectors(ops);
+    fprintf(stderr, "\n");
+    benchVarints(ops);
+
+    return 0;
+}
@@ -11,6 +11,8 @@
 #include <iostream>
 
 #include "pack.h"
+#include "pack_view.h"
+#include "pack_compact.h"
 #include "lockless/format.h"
 
 #include <boost/test/unit_test.hpp>
@@ -142,6 +144,51 @@ BOOST_AUTO_TEST_CASE(vectors)
                 { "blah", "bleeh", "blooooh" },
                 { "wee", "wheee", "whoooooo", "whoooooosh" }
             });
+
+    // Large enough to require the extended size header.
+    std::vector<uint16_t> large(1 << 17);
+    for (size_t i = 0; i < large.size(); ++i) large[i] = i;
+    check(large);
+}
+
+/** Bulk conversions must produce the same bytes as converting one element at
+    a time. The sizes are picked to hit the tails of the vectorized loops.
+ */
+template<typename T>
+void checkBulk()
+{
+    for (size_t n : { 0, 1, 3, 7, 15, 16, 17, 33, 65, 1031 }) {
+        std::vector<T> value(n);
+        for (size_t i = 0; i < n; ++i)
+            value[i] = T(0x0102030405060708ULL * (i + 1)) + T(i) / T(3);
+
+        Payload data = pack(value);
+
+        Payload expected(packedSize(value));
+        auto it = Payload::writeHeader(expected.begin(), n);
+        for (const auto& item : value) it = pack(item, it, expected.end());
+        BOOST_CHECK(it == expected.end());
+
+        BOOST_CHECK_EQUAL(data.size(), expected.size());
+        BOOST_CHECK(std::equal(data.cbegin(), data.cend(), expected.cbegin()));
+
+        std::vector<T> result = { T(1) };
+        auto last = unpack(result, data.cbegin(), data.cend());
+        BOOST_CHECK(last == data.cend());
+        BOOST_CHECK(value == result);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bulk_vectors)
+{
+    checkBulk<int8_t>();
+    checkBulk<uint16_t>();
+    checkBulk<int32_t>();
+    checkBulk<uint64_t>();
+    checkBulk<float>();
+    checkBulk<double>();
+
+    check(std::vector<bool>{ true, false, false, true });
 }
 
 
@@ -170,6 +217,160 @@ BOOST_AUTO_TEST_CASE(payloads)
 }
 
 
+BOOST_AUTO_TEST_CASE(large_payloads)
+{
+    for (size_t size : { 0xFFFD, 0xFFFE, 0xFFFF, 0x10000, 1 << 20 }) {
+        Payload value = pack(std::string(size, 'a'));
+        BOOST_CHECK_EQUAL(value.size(), size + 1);
+        BOOST_CHECK_EQUAL(
+                value.packetSize(), value.size() + Payload::headerSize(size + 1));
+
+        Payload copy = Payload::read(value.packet(), value.packetSize());
+        BOOST_CHECK_EQUAL(copy.size(), value.size());
+
+        auto result = unpack< std::tuple<int, Payload, int> >(
+                pack(std::make_tuple(1, value, 2)));
+        BOOST_CHECK_EQUAL(std::get<0>(result), 1);
+        BOOST_CHECK_EQUAL(std::get<2>(result), 2);
+        BOOST_CHECK_EQUAL(
+                unpack<std::string>(std::get<1>(result)), std::string(size, 'a'));
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(shared_payloads)
+{
+    // Large enough to be allocated; inline payloads are never shared.
+    const std::string str(Payload::InlineSize * 2, 'a');
+
+    Payload value = pack(str);
+    BOOST_CHECK(!value.isInline());
+    BOOST_CHECK(value.unique());
+
+    {
+        Payload copy = value;
+        BOOST_CHECK(!value.unique());
+        BOOST_CHECK_EQUAL(copy.bytes(), value.bytes());
+        BOOST_CHECK_EQUAL(copy.packet(), value.packet());
+
+        std::vector<Payload> copies(10, copy);
+        BOOST_CHECK_EQUAL(copies.back().bytes(), value.bytes());
+    }
+
+    BOOST_CHECK(value.unique());
+    BOOST_CHECK_EQUAL(unpack<std::string>(value), str);
+
+    Payload other = pack(size_t(10));
+    other = value;
+    other = other;
+    BOOST_CHECK_EQUAL(other.bytes(), value.bytes());
+
+    Payload moved = std::move(other);
+    BOOST_CHECK(!other);
+    BOOST_CHECK_EQUAL(moved.bytes(), value.bytes());
+}
+
+
+BOOST_AUTO_TEST_CASE(inline_payloads)
+{
+    for (size_t size : {
+                size_t(0), size_t(1), size_t(Payload::InlineSize - 1),
+                size_t(Payload::InlineSize), size_t(Payload::InlineSize + 1) })
+    {
+        Payload value = pack(std::string(size, 'a'));
+        std::string str = unpack<std::string>(value);
+        BOOST_CHECK_EQUAL(value.isInline(), value.size() <= Payload::InlineSize);
+        BOOST_CHECK(value.unique());
+
+        BOOST_CHECK_EQUAL(value.packet() + Payload::headerSize(value.size()), value.bytes());
+        Payload read = Payload::read(value.packet(), value.packetSize());
+        BOOST_CHECK_EQUAL(unpack<std::string>(read), str);
+
+        Payload copy = value;
+        BOOST_CHECK_EQUAL(copy.size(), value.size());
+        BOOST_CHECK_EQUAL(copy.isInline(), value.isInline());
+        BOOST_CHECK_EQUAL(unpack<std::string>(copy), str);
+
+        copy = copy;
+        BOOST_CHECK_EQUAL(unpack<std::string>(copy), str);
+
+        Payload other = pack(size_t(10));
+        other = value;
+        BOOST_CHECK_EQUAL(unpack<std::string>(other), str);
+
+        Payload moved = std::move(other);
+        BOOST_CHECK(!other);
+        BOOST_CHECK_EQUAL(unpack<std::string>(moved), str);
+
+        other = std::move(moved);
+        BOOST_CHECK(!moved);
+        BOOST_CHECK_EQUAL(unpack<std::string>(other), str);
+
+        // Packing a payload copies its packet which must be contiguous.
+        auto result = unpack< std::tuple<int, Payload, int> >(
+                pack(std::make_tuple(1, value, 2)));
+        BOOST_CHECK_EQUAL(std::get<0>(result), 1);
+        BOOST_CHECK_EQUAL(std::get<2>(result), 2);
+        BOOST_CHECK_EQUAL(unpack<std::string>(std::get<1>(result)), str);
+    }
+
+    Payload shrunk(Payload::InlineSize);
+    shrunk.shrink(3);
+    BOOST_CHECK(shrunk.isInline());
+    BOOST_CHECK_EQUAL(shrunk.size(), 3u);
+    BOOST_CHECK_EQUAL(shrunk.packetSize(), 3 + Payload::headerSize(3));
+}
+
+
+BOOST_AUTO_TEST_CASE(payload_chains)
+{
+    const std::string str(Payload::InlineSize * 4, 'a');
+    Payload body = pack(str);
+
+    auto value = std::make_tuple(size_t(1), body, std::string("bleh"), body);
+    Payload exp = packAll(size_t(1), body, std::string("bleh"), body);
+
+    PayloadChain chain = packChain(size_t(1), body, std::string("bleh"), body);
+    BOOST_CHECK_EQUAL(chain.size(), exp.size());
+    BOOST_CHECK_EQUAL(chain.packetSize(), exp.packetSize());
+    BOOST_CHECK_EQUAL(chain.fragments(), 4u);
+
+    Payload flat = chain.flatten();
+    BOOST_CHECK(std::equal(exp.cbegin(), exp.cend(), flat.cbegin()));
+
+    auto result = unpack<decltype(value)>(flat);
+    BOOST_CHECK_EQUAL(std::get<0>(result), 1u);
+    BOOST_CHECK_EQUAL(unpack<std::string>(std::get<1>(result)), str);
+    BOOST_CHECK_EQUAL(std::get<2>(result), "bleh");
+    BOOST_CHECK_EQUAL(unpack<std::string>(std::get<3>(result)), str);
+
+    // The bodies are referenced and not copied.
+    BOOST_CHECK(!body.unique());
+
+    // Every offset must yield the tail of the packet.
+    for (size_t offset = 0; offset < exp.packetSize(); ++offset) {
+        struct iovec iov[8];
+        size_t n = chain.iovecs(offset, iov, 8);
+
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; i < n; ++i) {
+            auto first = static_cast<const uint8_t*>(iov[i].iov_base);
+            bytes.insert(bytes.end(), first, first + iov[i].iov_len);
+        }
+
+        BOOST_CHECK_EQUAL(bytes.size(), exp.packetSize() - offset);
+        BOOST_CHECK(std::equal(bytes.begin(), bytes.end(), exp.packet() + offset));
+    }
+
+    BOOST_CHECK_EQUAL(chain.iovecs(0, nullptr, 0), 0u);
+
+    PayloadChain wrapped(pack(std::string("head")));
+    wrapped.appendPacket(body);
+    BOOST_CHECK(wrapped.flatten().packetSize() ==
+            packAll(std::string("head"), body).packetSize());
+}
+
+
 /******************************************************************************/
 /* CUSTOM                                                                     */
 /******************************************************************************/
@@ -219,9 +420,319 @@ BOOST_AUTO_TEST_CASE(customs)
     Foo value = { 1.0,  "Bob the structure", { 1, 2, 3, 4 } };
     Foo result = unpack<Foo>(pack(value));
     BOOST_CHECK(value == result);
+
+    // Foo still uses the value returning unpack so the end of each item has to
+    // be found through its packed size.
+    std::vector<Foo> list = { value, { 2.0, "", {} }, value };
+    Payload data = packAll(list, size_t(10));
+
+    std::vector<Foo> listResult;
+    size_t tail;
+    auto it = unpackAll(data.cbegin(), data.cend(), listResult, tail);
+
+    BOOST_CHECK(it == data.cend());
+    BOOST_CHECK(list == listResult);
+    BOOST_CHECK_EQUAL(tail, 10);
 }
 
 
+/******************************************************************************/
+/* STRUCT                                                                     */
+/******************************************************************************/
+
+struct Header
+{
+    uint16_t type;
+    uint32_t version;
+    uint64_t count;
+    double ratio;
+
+    bool operator==(const Header& other) const
+    {
+        return
+            type == other.type &&
+            version == other.version &&
+            count == other.count &&
+            ratio == other.ratio;
+    }
+};
+
+SLICK_PACK_STRUCT(Header, type, version, count, ratio)
+
+struct Message
+{
+    Header header;
+    std::string name;
+    std::vector<Header> list;
+};
+
+SLICK_PACK_STRUCT(Message, header, name, list)
+
+
+BOOST_AUTO_TEST_CASE(fixed_sizes)
+{
+    slickStaticAssert(Pack<uint32_t>::FixedSize == 4);
+    slickStaticAssert((Pack< std::pair<uint8_t, double> >::FixedSize == 9));
+    slickStaticAssert((Pack< std::tuple<uint16_t, uint64_t> >::FixedSize == 10));
+    slickStaticAssert((Pack< std::tuple<uint16_t, std::string> >::FixedSize == 0));
+    slickStaticAssert((slick::details::FixedSizeAll<uint8_t, float, uint16_t>::value == 7));
+    slickStaticAssert((slick::details::FixedSizeAll<uint8_t, std::string>::value == 0));
+
+    slickStaticAssert(Pack<Header>::FixedSize == 22);
+    slickStaticAssert((Pack< std::tuple<Header, uint8_t> >::FixedSize == 23));
+    slickStaticAssert(Pack<Message>::FixedSize == 0);
+
+    uint16_t a = 1;
+    uint64_t b = 2;
+    double c = 3.0;
+    std::tuple<uint16_t, uint64_t, double> tuple(a, b, c);
+
+    BOOST_CHECK_EQUAL(packedSizeAll(a, b, c), 18);
+    BOOST_CHECK_EQUAL(packedSize(tuple), 18);
+
+    // The fixed layout must match what packing one value at a time produces.
+    Payload data = packAll(a, b, c);
+    Payload expected(18);
+    auto it = pack(a, expected.begin(), expected.end());
+    it = pack(b, it, expected.end());
+    it = pack(c, it, expected.end());
+    BOOST_CHECK(it == expected.end());
+    BOOST_CHECK(std::equal(data.cbegin(), data.cend(), expected.cbegin()));
+
+    BOOST_CHECK(unpack<decltype(tuple)>(data) == tuple);
+
+    uint16_t ra; uint64_t rb; double rc;
+    auto last = unpackAll(data.cbegin(), data.cend(), ra, rb, rc);
+    BOOST_CHECK(last == data.cend());
+    BOOST_CHECK_EQUAL(ra, a);
+    BOOST_CHECK_EQUAL(rb, b);
+    BOOST_CHECK_EQUAL(rc, c);
+}
+
+BOOST_AUTO_TEST_CASE(structs)
+{
+    Header header = { 1, 2, 3, 4.0 };
+
+    Payload data = pack(header);
+    BOOST_CHECK_EQUAL(data.size(), 22);
+
+    Payload fields = packAll(header.type, header.version, header.count, header.ratio);
+    BOOST_CHECK(std::equal(data.cbegin(), data.cend(), fields.cbegin()));
+    BOOST_CHECK(unpack<Header>(data) == header);
+
+    Message msg;
+    msg.header = header;
+    msg.name = "bleh";
+    for (size_t i = 0; i < 10; ++i)
+        msg.list.push_back(Header{ uint16_t(i), 1, i * 2, i / 2.0 });
+
+    Payload msgData = pack(msg);
+    Message result = unpack<Message>(msgData);
+    BOOST_CHECK(result.header == msg.header);
+    BOOST_CHECK_EQUAL(result.name, msg.name);
+    BOOST_CHECK(result.list == msg.list);
+
+    // Fixed size items can be accessed randomly through a view.
+    Header headerView;
+    StringView nameView;
+    PackedVectorView<Header> listView;
+    auto it = unpackAll(msgData.cbegin(), msgData.cend(), headerView, nameView, listView);
+    BOOST_CHECK(it == msgData.cend());
+    BOOST_CHECK_EQUAL(listView.size(), msg.list.size());
+    for (size_t i = 0; i < msg.list.size(); ++i)
+        BOOST_CHECK(listView[i] == msg.list[i]);
+}
+
+/******************************************************************************/
+/* VIEWS                                                                      */
+/******************************************************************************/
+
+bool within(const void* ptr, const Payload& data)
+{
+    auto p = reinterpret_cast<const uint8_t*>(ptr);
+    return p >= data.cbegin() && p < data.cend();
+}
+
+BOOST_AUTO_TEST_CASE(views)
+{
+    typedef std::tuple<std::string, uint64_t> Item;
+
+    std::string key = "bleh";
+    std::vector<std::string> strings = { "a", "", "blooooooooooooooh" };
+    std::vector<Item> items = { Item("x", 1), Item("yy", 2), Item("zzz", 3) };
+    std::vector<uint32_t> ints = { 1, 2, 3, 4, 5 };
+    Payload nested = pack(std::string(Payload::InlineSize * 2, 'b'));
+
+    Payload data = packAll(key, strings, items, ints, nested);
+
+    StringView keyView;
+    PackedVectorView<StringView> stringsView;
+    PackedVectorView< std::tuple<StringView, uint64_t> > itemsView;
+    PackedVectorView<uint32_t> intsView;
+    PayloadView nestedView;
+
+    auto it = unpackAll(data.cbegin(), data.cend(),
+            keyView, stringsView, itemsView, intsView, nestedView);
+    BOOST_CHECK(it == data.cend());
+
+    BOOST_CHECK_EQUAL(keyView, key);
+    BOOST_CHECK(within(keyView.data(), data));
+
+    BOOST_CHECK_EQUAL(stringsView.size(), strings.size());
+    size_t i = 0;
+    for (StringView str : stringsView) {
+        BOOST_CHECK_EQUAL(str, strings[i++]);
+        BOOST_CHECK(within(str.data(), data));
+    }
+    BOOST_CHECK_EQUAL(i, strings.size());
+
+    i = 0;
+    for (const auto& item : itemsView) {
+        BOOST_CHECK_EQUAL(std::get<0>(item), std::get<0>(items[i]));
+        BOOST_CHECK_EQUAL(std::get<1>(item), std::get<1>(items[i]));
+        i++;
+    }
+    BOOST_CHECK_EQUAL(i, items.size());
+
+    BOOST_CHECK_EQUAL(intsView.size(), ints.size());
+    for (size_t i = 0; i < ints.size(); ++i)
+        BOOST_CHECK_EQUAL(intsView[i], ints[i]);
+
+    BOOST_CHECK_EQUAL(nestedView.size(), nested.size());
+    BOOST_CHECK(within(nestedView.cbegin(), data));
+    BOOST_CHECK_EQUAL(unpack<std::string>(nestedView.cbegin(), nestedView.cend()),
+            unpack<std::string>(nested));
+
+    Payload copy = nestedView.payload();
+    BOOST_CHECK(std::equal(copy.cbegin(), copy.cend(), nested.cbegin()));
+
+    // Views are packed back as they were which allows forwarding.
+    Payload forward = packAll(keyView, stringsView, itemsView, intsView, nestedView);
+    BOOST_CHECK_EQUAL(forward.size(), data.size());
+    BOOST_CHECK(std::equal(forward.cbegin(), forward.cend(), data.cbegin()));
+
+    std::vector<std::string> stringsResult;
+    std::vector<Item> itemsResult;
+    unpackAll(forward, key, stringsResult, itemsResult);
+    BOOST_CHECK(strings == stringsResult);
+    BOOST_CHECK(items == itemsResult);
+}
+
+BOOST_AUTO_TEST_CASE(empty_views)
+{
+    Payload data = packAll(
+            std::string(), std::vector<std::string>(), Payload(size_t(0)));
+
+    StringView str;
+    PackedVectorView<StringView> list;
+    PayloadView nested;
+    unpackAll(data, str, list, nested);
+
+    BOOST_CHECK(str.empty());
+    BOOST_CHECK(list.empty());
+    BOOST_CHECK(list.begin() == list.end());
+    BOOST_CHECK(nested.empty());
+
+    Payload forward = packAll(str, list, PayloadView());
+    BOOST_CHECK_EQUAL(forward.size(), data.size());
+    BOOST_CHECK(std::equal(forward.cbegin(), forward.cend(), data.cbegin()));
+}
+
+/******************************************************************************/
+/* COMPACT                                                                    */
+/******************************************************************************/
+
+template<typename T>
+void checkCompact(T value, size_t size)
+{
+    Payload data = pack(compact(value));
+    BOOST_CHECK_EQUAL(data.size(), size);
+
+    Compact<T> result;
+    auto it = unpack(result, data.cbegin(), data.cend());
+    BOOST_CHECK(it == data.cend());
+    BOOST_CHECK_EQUAL(result.value, value);
+
+    // Followed by enough bytes to go through the word at a time decoder.
+    data = packAll(compact(value), uint64_t(-1));
+    uint64_t tail = 0;
+    it = unpackAll(data.cbegin(), data.cend(), result, tail);
+    BOOST_CHECK(it == data.cend());
+    BOOST_CHECK_EQUAL(result.value, value);
+    BOOST_CHECK_EQUAL(tail, uint64_t(-1));
+}
+
+BOOST_AUTO_TEST_CASE(compact_ints)
+{
+    Payload data = pack(compact(uint16_t(300)));
+    BOOST_CHECK_EQUAL(data.size(), 2);
+    BOOST_CHECK_EQUAL(data.bytes()[0], 0xAC);
+    BOOST_CHECK_EQUAL(data.bytes()[1], 0x02);
+
+    checkCompact<uint8_t>(0, 1);
+    checkCompact<uint8_t>(255, 2);
+    checkCompact<uint32_t>(127, 1);
+    checkCompact<uint32_t>(128, 2);
+    checkCompact<uint32_t>(16383, 2);
+    checkCompact<uint32_t>(16384, 3);
+    checkCompact<uint64_t>((1ULL << 49) - 1, 7);
+    checkCompact<uint64_t>((1ULL << 56) - 1, 8);
+    checkCompact<uint64_t>(1ULL << 56, 9);
+    checkCompact<uint64_t>(-1, 10);
+    checkCompact<size_t>(3600, 2);
+
+    checkCompact<int32_t>(0, 1);
+    checkCompact<int32_t>(-1, 1);
+    checkCompact<int32_t>(63, 1);
+    checkCompact<int32_t>(-64, 1);
+    checkCompact<int32_t>(64, 2);
+    checkCompact<int16_t>(std::numeric_limits<int16_t>::min(), 3);
+    checkCompact<int64_t>(std::numeric_limits<int64_t>::min(), 10);
+    checkCompact<int64_t>(std::numeric_limits<int64_t>::max(), 10);
+
+    for (size_t shift = 0; shift < 64; ++shift) {
+        uint64_t value = 1ULL << shift;
+        checkCompact<uint64_t>(value - 1, (std::max<size_t>(shift, 1) + 6) / 7);
+        checkCompact<uint64_t>(value, (shift + 7) / 7);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compact_containers)
+{
+    typedef std::tuple<std::string, Compact<size_t> > Item;
+
+    std::vector<Item> items = { Item("a", 1), Item("b", 300), Item("c", 1 << 20) };
+    std::vector<uint64_t> ints(200, 1);
+    Payload nested = pack(std::string("bleh"));
+
+    Payload data = packAll(compact(items), compact(ints), compact(nested));
+
+    size_t itemsSize = 1 + (2 + 1) + (2 + 2) + (2 + 3);
+    size_t intsSize = 2 + 200 * sizeof(uint64_t);
+    size_t nestedSize = 1 + nested.size();
+    BOOST_CHECK_EQUAL(data.size(), itemsSize + intsSize + nestedSize);
+
+    Compact< std::vector<Item> > itemsResult;
+    Compact< std::vector<uint64_t> > intsResult;
+    Compact<Payload> nestedResult;
+    auto it = unpackAll(data.cbegin(), data.cend(),
+            itemsResult, intsResult, nestedResult);
+
+    BOOST_CHECK(it == data.cend());
+    BOOST_CHECK_EQUAL(itemsResult.value.size(), items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        BOOST_CHECK_EQUAL(std::get<0>(itemsResult.value[i]), std::get<0>(items[i]));
+        BOOST_CHECK_EQUAL(
+                std::get<1>(itemsResult.value[i]).value,
+                std::get<1>(items[i]).value);
+    }
+    BOOST_CHECK(intsResult.value == ints);
+    BOOST_CHECK_EQUAL(unpack<std::string>(nestedResult.value), "bleh");
+
+    Payload empty = packAll(compact(Payload()), compact(std::vector<int>()));
+    BOOST_CHECK_EQUAL(empty.size(), 2);
+}
+
 /******************************************************************************/
 /* INCREMENTAL                                                                */
 /******************************************************************************/
@@ -245,3 +756,37 @@ BOOST_AUTO_TEST_CASE(incremental)
     it = check(std::get<1>(value), it, last);
     it = check(std::get<2>(value), it, last);
 }
+
+BOOST_AUTO_TEST_CASE(nested_incremental)
+{
+    typedef std::tuple<std::string, std::vector<Payload> > Item;
+
+    std::vector<std::string> strings = { "a", "", "bleh" };
+    std::vector<Item> items = {
+        Item("first", { pack(size_t(1)), pack(std::string("blah")) }),
+        Item("", {}),
+    };
+    auto pair = std::make_pair(std::string("key"), 2.0);
+
+    Payload pl = packAll(strings, items, pair, uint16_t(3));
+    auto it = pl.cbegin(), last = pl.cend();
+
+    std::vector<std::string> stringsResult = { "stale" };
+    it = unpack(stringsResult, it, last);
+    BOOST_CHECK(strings == stringsResult);
+    BOOST_CHECK(it == pl.cbegin() + packedSize(strings));
+
+    std::vector<Item> itemsResult;
+    it = unpack(itemsResult, it, last);
+    BOOST_CHECK_EQUAL(itemsResult.size(), items.size());
+    BOOST_CHECK_EQUAL(std::get<0>(itemsResult[0]), "first");
+    BOOST_CHECK_EQUAL(std::get<1>(itemsResult[0]).size(), 2);
+    BOOST_CHECK_EQUAL(unpack<size_t>(std::get<1>(itemsResult[0])[0]), 1);
+    BOOST_CHECK_EQUAL(unpack<std::string>(std::get<1>(itemsResult[0])[1]), "blah");
+    BOOST_CHECK(std::get<1>(itemsResult[1]).empty());
+
+    it = check(pair.first, it, last);
+    it = check(pair.second, it, last);
+    it = check(uint16_t(3), it, last);
+    BOOST_CHECK(it == last);
+}
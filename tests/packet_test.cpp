@@ -3,6 +3,22 @@
    FreeBSD-style copyright and disclaimer apply
 
    Packet sending and timing test.
+
+   Usage:
+
+       packet_test [-cork] [-uring] [-large] [-zerocopy] p [port]
+       packet_test [-cork] [-uring] [-large] [-zerocopy] c uri...
+
+   The -cork option enables the corked mode of the endpoints which batches the
+   sends into vectored writes. Compare the sys/msg stat with and without it to
+   see how many send syscalls are issued per message.
+
+   The -uring option switches the endpoints over to the io_uring backend.
+
+   The -large option sends multi-MiB frames instead of tiny ones and reports
+   the bandwidth. Both ends must agree on it since it raises the max frame
+   size. The -zerocopy option sends the frames with MSG_ZEROCOPY; note that
+   the kernel falls back on copies over loopback.
 */
 
 #include "endpoint.h"
@@ -27,9 +43,35 @@ using namespace lockless;
 
 enum {
     PayloadSize = 32,
+    LargePayloadSize = 1 << 22,
     RefreshRate = 200,
 };
 
+struct Config
+{
+    Config() :
+        cork(false), backend(Endpoint::EpollBackend),
+        large(false), zeroCopy(false)
+    {}
+
+    bool cork;
+    Endpoint::IoBackend backend;
+    bool large;
+    bool zeroCopy;
+
+    size_t payloadSize() const
+    {
+        return large ? size_t(LargePayloadSize) : size_t(PayloadSize);
+    }
+
+    void apply(Endpoint& endpoint) const
+    {
+        endpoint.cork(cork);
+        if (large) endpoint.maxFrameSize(LargePayloadSize * 2);
+        if (zeroCopy) endpoint.zeroCopy();
+    }
+};
+
 string getStats(size_t value, size_t& oldValue)
 {
     size_t diff = value - oldValue;
@@ -40,44 +82,71 @@ string getStats(size_t value, size_t& oldValue)
     return fmtValue(diff);
 }
 
+string getSyscallStats(const Endpoint::Stats& stats)
+{
+    if (!stats.sentPayloads) return "0";
+    double ratio = double(stats.sendCalls) / stats.sentPayloads;
+    return lockless::format("%.3f", ratio);
+}
+
+string getBandwidth(const Config& config, size_t msgs, size_t& oldMsgs)
+{
+    if (!config.large) return "";
+
+    size_t bytes = (msgs - oldMsgs) * config.payloadSize();
+    bytes *= 1000 / RefreshRate;
+
+    oldMsgs = msgs;
+
+    return ", bw: " + fmtValue(bytes) + "B/s";
+}
+
 
 /******************************************************************************/
 /* PROVIDER                                                                   */
 /******************************************************************************/
 
-void runProvider(Port port)
+void runProvider(Port port, const Config& config)
 {
     size_t recv = 0, dropped = 0;
 
-    Endpoint provider(port);
+    Endpoint provider(port, config.backend);
+    config.apply(provider);
 
-    provider.onNewConnection = [] (int fd) {
-        fprintf(stderr, "\nprv: new %d\n", fd);;
+    provider.onNewConnection = [] (ConnId conn) {
+        fprintf(stderr, "\nprv: new %d\n", connFd(conn));;
     };
-    provider.onLostConnection = [] (int fd) {
-        fprintf(stderr, "\nprv: lost %d\n", fd);;
+    provider.onLostConnection = [] (ConnId conn) {
+        fprintf(stderr, "\nprv: lost %d\n", connFd(conn));;
     };
 
-    provider.onPayload = [&] (int fd, Payload&& data) {
+    provider.onPayload = [&] (ConnId conn, Payload&& data) {
         recv++;
-        provider.send(fd, move(data));
+        provider.send(conn, move(data));
     };
-    provider.onDroppedPayload = [&] (int, Payload&&) {
+    provider.onDroppedPayload = [&] (ConnId, Payload&&) {
         dropped++;
     };
 
-    thread pollTh([&] { while (true) provider.poll(100); });
+    thread pollTh([&] {
+                provider.startPolling();
+                while (true) provider.poll(100);
+            });
 
     double start = lockless::wall();
-    size_t oldRecv = 0;
+    size_t oldRecv = 0, oldBw = 0;
 
     while (true) {
         lockless::sleep(RefreshRate);
 
+        string bandwidth = getBandwidth(config, recv, oldBw);
         string diffRecv = getStats(recv, oldRecv);
+        string syscalls = getSyscallStats(provider.stats());
         string elapsed = fmtElapsed(wall() - start);
 
-        fprintf(stderr, "\r%s> recv: %s ", elapsed.c_str(), diffRecv.c_str());
+        fprintf(stderr, "\r%s> recv: %s, sys/msg: %s%s ",
+                elapsed.c_str(), diffRecv.c_str(), syscalls.c_str(),
+                bandwidth.c_str());
     }
 }
 
@@ -86,31 +155,35 @@ void runProvider(Port port)
 /* CLIENT                                                                     */
 /******************************************************************************/
 
-void runClient(vector<string> uris)
+void runClient(vector<string> uris, const Config& config)
 {
     size_t sent = 0, recv = 0, dropped = 0;
 
-    Endpoint client;
+    Endpoint client(config.backend);
+    config.apply(client);
 
-    client.onNewConnection = [] (int fd) {
-        fprintf(stderr, "\ncli: new %d\n", fd);;
+    client.onNewConnection = [] (ConnId conn) {
+        fprintf(stderr, "\ncli: new %d\n", connFd(conn));;
     };
-    client.onLostConnection = [] (int fd) {
-        fprintf(stderr, "\ncli: lost %d\n", fd);;
+    client.onLostConnection = [] (ConnId conn) {
+        fprintf(stderr, "\ncli: lost %d\n", connFd(conn));;
     };
 
-    client.onPayload = [&] (int, Payload&&) {
+    client.onPayload = [&] (ConnId, Payload&&) {
         recv++;
     };
-    client.onDroppedPayload = [&] (int, Payload&&) {
+    client.onDroppedPayload = [&] (ConnId, Payload&&) {
         dropped++;
     };
 
     for (auto& uri : uris) client.connect(uri);
 
-    thread pollTh([&] { while (true) client.poll(100); });
+    thread pollTh([&] {
+                client.startPolling();
+                while (true) client.poll(100);
+            });
 
-    Payload payload = pack(string(PayloadSize, 'a'));
+    Payload payload = pack(string(config.payloadSize(), 'a'));
     auto sendFn = [&] {
         while (true) {
             client.broadcast(payload);
@@ -121,18 +194,21 @@ void runClient(vector<string> uris)
 
 
     double start = wall();
-    size_t oldSent = 0, oldRecv = 0;
+    size_t oldSent = 0, oldRecv = 0, oldBw = 0;
 
     while (true) {
         lockless::sleep(200);
 
+        string bandwidth = getBandwidth(config, recv, oldBw);
         string diffSent = getStats(sent - dropped, oldSent);
         string diffRecv = getStats(recv, oldRecv);
+        string syscalls = getSyscallStats(client.stats());
         string elapsed = fmtElapsed(wall() - start);
 
         fprintf(stderr,
-                "\r%s> sent: %s, recv: %s",
-                elapsed.c_str(), diffSent.c_str(), diffRecv.c_str());
+                "\r%s> sent: %s, recv: %s, sys/msg: %s%s ",
+                elapsed.c_str(), diffSent.c_str(), diffRecv.c_str(),
+                syscalls.c_str(), bandwidth.c_str());
     }
 }
 
@@ -143,21 +219,32 @@ void runClient(vector<string> uris)
 
 int main(int argc, char** argv)
 {
-    assert(argc >= 2);
+    Config config;
+
+    vector<string> args;
+    for (size_t i = 1; i < size_t(argc); ++i) {
+        string arg = argv[i];
+
+        if (arg == "-cork") config.cork = true;
+        else if (arg == "-uring") config.backend = Endpoint::UringBackend;
+        else if (arg == "-large") config.large = true;
+        else if (arg == "-zerocopy") config.zeroCopy = true;
+        else args.emplace_back(arg);
+    }
+
+    assert(args.size() >= 1);
 
-    if (argv[1][0] == 'p') {
+    if (args[0][0] == 'p') {
         Port port = 30000;
-        if (argc >= 3) port = atoi(argv[2]);
-        runProvider(port);
+        if (args.size() >= 2) port = atoi(args[1].c_str());
+        runProvider(port, config);
     }
 
-    else if (argv[1][0] == 'c') {
-        assert(argc >= 3);
+    else if (args[0][0] == 'c') {
+        assert(args.size() >= 2);
 
-        vector<string> uris;
-        for (size_t i = 2; i < size_t(argc); ++i)
-            uris.emplace_back(argv[i]);
-        runClient(uris);
+        vector<string> uris(args.begin() + 1, args.end());
+        runClient(uris, config);
     }
 
     else assert(false);
@@ -0,0 +1,127 @@
+/* payload_perf_test.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 20 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Throughput comparison of the payload allocator against operator new.
+
+   Usage:
+
+       payload_perf_test [ops]
+
+   The local runs allocate and free on the same thread while the remote runs
+   free on a different thread then the one that allocated, which is what the
+   endpoints do with payloads sent from outside of the polling thread.
+*/
+
+#include "payload.h"
+#include "queue.h"
+#include "lockless/format.h"
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+
+using namespace std;
+using namespace slick;
+using namespace lockless;
+
+
+/******************************************************************************/
+/* ALLOCATORS                                                                 */
+/******************************************************************************/
+
+struct NewAlloc
+{
+    typedef uint8_t* Ptr;
+    static Ptr alloc(size_t size) { return new uint8_t[size]; }
+    static void free(Ptr ptr) { delete[] ptr; }
+};
+
+struct PayloadAlloc
+{
+    typedef Payload Ptr;
+    static Ptr alloc(size_t size) { return Payload(size); }
+    static void free(Ptr ptr) { ptr.clear(); }
+};
+
+
+/******************************************************************************/
+/* BENCH                                                                      */
+/******************************************************************************/
+
+enum { QueueSize = 1 << 8, Batch = 1 << 6 };
+
+template<typename Alloc>
+double benchLocal(size_t size, size_t ops)
+{
+    vector<typename Alloc::Ptr> ptrs(Batch);
+
+    auto start = chrono::steady_clock::now();
+
+    // Batched to keep a handful of live allocations around like a send queue
+    // would.
+    for (size_t i = 0; i < ops; i += Batch) {
+        for (auto& ptr : ptrs) ptr = Alloc::alloc(size);
+        for (auto& ptr : ptrs) Alloc::free(std::move(ptr));
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return ops / elapsed.count();
+}
+
+template<typename Alloc>
+double benchRemote(size_t size, size_t ops)
+{
+    MpscQueue<typename Alloc::Ptr, QueueSize> queue;
+
+    auto start = chrono::steady_clock::now();
+
+    thread producer([&] {
+                for (size_t i = 0; i < ops; ++i) {
+                    Backoff backoff;
+                    auto ptr = Alloc::alloc(size);
+                    while (!queue.push(std::move(ptr))) backoff();
+                }
+            });
+
+    for (size_t i = 0; i < ops; ++i) {
+        Backoff backoff;
+        while (queue.empty()) backoff();
+        Alloc::free(queue.pop());
+    }
+
+    producer.join();
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return ops / elapsed.count();
+}
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char** argv)
+{
+    size_t ops = 1000000;
+    if (argc > 1) ops = stoull(string(argv[1]));
+
+    fprintf(stderr, "%-8s %-12s %-12s %-12s %-12s\n",
+            "size", "local-new", "local-pool", "remote-new", "remote-pool");
+
+    for (size_t size : { 16, 64, 256, 1024, 4096, 16384, 65536 }) {
+        double localNew = benchLocal<NewAlloc>(size, ops);
+        double localPool = benchLocal<PayloadAlloc>(size, ops);
+        double remoteNew = benchRemote<NewAlloc>(size, ops);
+        double remotePool = benchRemote<PayloadAlloc>(size, ops);
+
+        fprintf(stderr, "%-8zu %-12s %-12s %-12s %-12s\n",
+                size,
+                fmtValue(localNew).c_str(), fmtValue(localPool).c_str(),
+                fmtValue(remoteNew).c_str(), fmtValue(remotePool).c_str());
+    }
+
+    return 0;
+}
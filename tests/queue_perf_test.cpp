@@ -0,0 +1,97 @@
+/* queue_perf_test.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 17 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Throughput comparison of the defer queues.
+
+   Usage:
+
+       queue_perf_test [ops per producer]
+
+   Runs a single consumer against an increasing number of producers for both
+   the spin locked Queue and the lock-free MpscQueue. The SpscQueue used by the
+   per-thread rings of ThreadLocalDefer is measured with a single producer.
+*/
+
+#include "queue.h"
+#include "lockless/format.h"
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <cassert>
+
+using namespace std;
+using namespace slick;
+using namespace lockless;
+
+
+/******************************************************************************/
+/* BENCH                                                                      */
+/******************************************************************************/
+
+enum { QueueSize = 1 << 6 };
+
+template<typename Queue>
+double bench(size_t producers, size_t ops)
+{
+    Queue queue;
+    vector<thread> threads;
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t id = 0; id < producers; ++id) {
+        threads.emplace_back([&] {
+                    for (size_t i = 0; i < ops; ++i) {
+                        Backoff backoff;
+                        while (!queue.push(i)) backoff();
+                    }
+                });
+    }
+
+    size_t sum = 0;
+    for (size_t i = 0; i < producers * ops; ++i) {
+        Backoff backoff;
+        while (queue.empty()) backoff();
+        sum += queue.pop();
+    }
+
+    for (auto& th : threads) th.join();
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    assert(sum == producers * ((ops * (ops - 1)) / 2));
+    (void) sum;
+
+    return (producers * ops) / elapsed.count();
+}
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char** argv)
+{
+    size_t ops = 1000000;
+    if (argc > 1) ops = stoull(string(argv[1]));
+
+    size_t maxProducers = thread::hardware_concurrency() * 2;
+
+    fprintf(stderr, "%-10s %-12s %-12s\n", "producers", "locked", "lock-free");
+
+    for (size_t producers = 1; producers <= maxProducers; producers *= 2) {
+        double locked = bench< Queue<size_t, QueueSize> >(producers, ops);
+        double lockFree = bench< MpscQueue<size_t, QueueSize> >(producers, ops);
+
+        fprintf(stderr, "%-10zu %-12s %-12s\n",
+                producers, fmtValue(locked).c_str(), fmtValue(lockFree).c_str());
+    }
+
+    double spsc = bench< SpscQueue<size_t, QueueSize> >(1, ops);
+    fprintf(stderr, "\nspsc: %s\n", fmtValue(spsc).c_str());
+
+    return 0;
+}
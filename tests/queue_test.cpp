@@ -0,0 +1,275 @@
+/* queue_test.cpp                                 -*- C++ -*-
+   Rémi Attab (remi.attab@gmail.com), 17 Feb 2014
+   FreeBSD-style copyright and disclaimer apply
+
+   Tests for the defer queues.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "queue.h"
+#include "defer.h"
+
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <sys/poll.h>
+
+using namespace std;
+using namespace slick;
+
+
+/******************************************************************************/
+/* MPSC QUEUE                                                                 */
+/******************************************************************************/
+
+BOOST_AUTO_TEST_CASE(mpsc_seq)
+{
+    enum { Size = 8 };
+    MpscQueue<string, Size> queue;
+
+    BOOST_CHECK(queue.empty());
+
+    for (size_t lap = 0; lap < 3; ++lap) {
+        for (size_t i = 0; i < Size; ++i)
+            BOOST_CHECK(queue.push(to_string(i)));
+
+        string val("bleh");
+        BOOST_CHECK(!queue.push(std::move(val)));
+        BOOST_CHECK_EQUAL(val, "bleh");
+        BOOST_CHECK_EQUAL(queue.size(), Size);
+
+        for (size_t i = 0; i < Size; ++i) {
+            BOOST_CHECK(!queue.empty());
+            BOOST_CHECK_EQUAL(queue.pop(), to_string(i));
+        }
+
+        BOOST_CHECK(queue.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mpsc_para)
+{
+    enum { Producers = 8, Ops = 100000 };
+    MpscQueue<size_t, 64> queue;
+
+    vector<thread> threads;
+    for (size_t id = 0; id < Producers; ++id) {
+        threads.emplace_back([&, id] {
+                    for (size_t i = 0; i < Ops; ++i) {
+                        Backoff backoff;
+                        while (!queue.push(id * Ops + i)) backoff();
+                    }
+                });
+    }
+
+    // Values from a single producer must come out in the order they were
+    // pushed.
+    vector<size_t> last(Producers, 0);
+    vector<size_t> count(Producers, 0);
+
+    for (size_t i = 0; i < Producers * Ops; ++i) {
+        Backoff backoff;
+        while (queue.empty()) backoff();
+
+        size_t val = queue.pop();
+        size_t id = val / Ops;
+
+        if (count[id]) BOOST_CHECK_LT(last[id], val);
+        last[id] = val;
+        count[id]++;
+    }
+
+    for (auto& th : threads) th.join();
+
+    BOOST_CHECK(queue.empty());
+    for (size_t id = 0; id < Producers; ++id)
+        BOOST_CHECK_EQUAL(count[id], Ops);
+}
+
+
+/******************************************************************************/
+/* SPSC QUEUE                                                                 */
+/******************************************************************************/
+
+BOOST_AUTO_TEST_CASE(spsc_seq)
+{
+    enum { Size = 8 };
+    SpscQueue<string, Size> queue;
+
+    BOOST_CHECK(queue.empty());
+
+    for (size_t lap = 0; lap < 3; ++lap) {
+        for (size_t i = 0; i < Size; ++i)
+            BOOST_CHECK(queue.push(to_string(i)));
+
+        string val("bleh");
+        BOOST_CHECK(!queue.push(std::move(val)));
+        BOOST_CHECK_EQUAL(val, "bleh");
+        BOOST_CHECK_EQUAL(queue.size(), Size);
+
+        for (size_t i = 0; i < Size; ++i) {
+            BOOST_CHECK(!queue.empty());
+            BOOST_CHECK_EQUAL(queue.pop(), to_string(i));
+        }
+
+        BOOST_CHECK(queue.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(spsc_para)
+{
+    enum { Ops = 1000000 };
+    SpscQueue<size_t, 64> queue;
+
+    thread producer([&] {
+                for (size_t i = 0; i < Ops; ++i) {
+                    Backoff backoff;
+                    while (!queue.push(i)) backoff();
+                }
+            });
+
+    for (size_t i = 0; i < Ops; ++i) {
+        Backoff backoff;
+        while (queue.empty()) backoff();
+        BOOST_CHECK_EQUAL(queue.pop(), i);
+    }
+
+    producer.join();
+    BOOST_CHECK(queue.empty());
+}
+
+
+/******************************************************************************/
+/* THREAD LOCAL DEFER                                                         */
+/******************************************************************************/
+
+BOOST_AUTO_TEST_CASE(thread_local_defer)
+{
+    enum { Producers = 4, Ops = 10000 };
+
+    ThreadLocalDefer<64, size_t, std::string> defer;
+
+    vector<size_t> last(Producers, 0);
+    vector<size_t> count(Producers, 0);
+
+    defer.onOperation = [&] (size_t&& id, std::string&& val) {
+        size_t i = stoull(val);
+        if (count[id]) BOOST_CHECK_LT(last[id], i);
+        last[id] = i;
+        count[id]++;
+    };
+
+    std::atomic<size_t> done(0);
+    vector<thread> threads;
+    for (size_t id = 0; id < Producers; ++id) {
+        threads.emplace_back([&, id] {
+                    for (size_t i = 0; i < Ops; ++i) {
+                        if (i % 2) defer.defer(id, to_string(i));
+                        else while (!defer.tryDefer(id, to_string(i)));
+                    }
+                    done++;
+                });
+    }
+
+    size_t total = 0;
+    while (total < Producers * Ops) {
+        struct pollfd fds = { defer.fd(), POLLIN, 0 };
+        ::poll(&fds, 1, 100);
+
+        defer.poll(16);
+
+        total = 0;
+        for (size_t n : count) total += n;
+    }
+
+    for (auto& th : threads) th.join();
+    BOOST_CHECK_EQUAL(done, Producers);
+
+    for (size_t id = 0; id < Producers; ++id)
+        BOOST_CHECK_EQUAL(count[id], Ops);
+}
+
+BOOST_AUTO_TEST_CASE(thread_local_defer_objects)
+{
+    // More objects than the thread local cache has entries so that the
+    // producers keep having to look up their rings again.
+    enum { Objects = 20, Producers = 2, Ops = 10000 };
+
+    vector< unique_ptr< ThreadLocalDefer<8, size_t, size_t> > > defers;
+    vector< vector<size_t> > last(Objects, vector<size_t>(Producers, 0));
+    vector< vector<size_t> > count(Objects, vector<size_t>(Producers, 0));
+
+    for (size_t obj = 0; obj < Objects; ++obj) {
+        defers.emplace_back(new ThreadLocalDefer<8, size_t, size_t>());
+        defers.back()->onOperation = [&, obj] (size_t&& id, size_t&& i) {
+            if (count[obj][id]) BOOST_CHECK_LT(last[obj][id], i);
+            last[obj][id] = i;
+            count[obj][id]++;
+        };
+    }
+
+    vector<thread> threads;
+    for (size_t id = 0; id < Producers; ++id) {
+        threads.emplace_back([&, id] {
+                    for (size_t i = 0; i < Ops; ++i)
+                        defers[i % Objects]->defer(id, i);
+                });
+    }
+
+    size_t total = 0;
+    while (total < Producers * Ops) {
+        total = 0;
+        for (size_t obj = 0; obj < Objects; ++obj) {
+            defers[obj]->poll();
+            for (size_t n : count[obj]) total += n;
+        }
+    }
+
+    for (auto& th : threads) th.join();
+}
+
+
+/******************************************************************************/
+/* WAIT POLICIES                                                              */
+/******************************************************************************/
+
+/** Tiny queue so that the producer keeps waiting on the consumer. */
+template<typename DeferT>
+void testWaitPolicy()
+{
+    enum { Ops = 1000 };
+
+    DeferT defer;
+
+    size_t count = 0;
+    defer.onOperation = [&] (size_t&& i) {
+        BOOST_CHECK_EQUAL(i, count);
+        count++;
+    };
+
+    thread producer([&] {
+                for (size_t i = 0; i < Ops; ++i) defer.defer(i);
+            });
+
+    while (count < Ops) {
+        struct pollfd fds = { defer.fd(), POLLIN, 0 };
+        ::poll(&fds, 1, 100);
+
+        defer.poll();
+    }
+
+    producer.join();
+}
+
+BOOST_AUTO_TEST_CASE(wait_policies)
+{
+    testWaitPolicy< BasicDefer<SpinBackoff, 4, size_t> >();
+    testWaitPolicy< BasicDefer<YieldBackoff, 4, size_t> >();
+    testWaitPolicy< BasicThreadLocalDefer<SpinBackoff, 4, size_t> >();
+    testWaitPolicy< BasicThreadLocalDefer<YieldBackoff, 4, size_t> >();
+}